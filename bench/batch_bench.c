@@ -0,0 +1,91 @@
+/* Compares htGetBatch against a loop of htGet on tables of various sizes.
+ * The sizes can be given on the command line, e.g. 1000000 16000000 128000000;
+ * the largest one needs around 6 GB of memory, so it's not run by default.
+ * With --huge, the tables are backed by htHugePageAllocator. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_LOOKUPS 4000000
+#define CHUNK 256
+
+static struct HT_params params;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void bench_size(size_t size)
+{
+	uint64_t *keys = malloc(size * sizeof(*keys));
+	struct HT ht = htNewWith(size / 0.8 + 1, sizeof(uint64_t), &params);
+	for (size_t i = 0; i < size; ++i) {
+		keys[i] = i * 0x9E3779B97F4A7C15ull;
+		htSet(&ht, &keys[i], sizeof(*keys), &keys[i]);
+	}
+
+	void const **names = malloc(NUM_LOOKUPS * sizeof(*names));
+	HT_len *lengths = malloc(NUM_LOOKUPS * sizeof(*lengths));
+	uint64_t state = 88172645463325252ull;
+	for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+		names[i] = &keys[xorshift(&state) % size];
+		lengths[i] = sizeof(*keys);
+	}
+
+	uint64_t sink = 0;
+	double start = now();
+	for (size_t i = 0; i < NUM_LOOKUPS; ++i)
+		sink += *(uint64_t *)htGet(&ht, names[i], lengths[i]);
+	double single = (now() - start) / NUM_LOOKUPS * 1e9;
+
+	void *out[CHUNK];
+	start = now();
+	for (size_t i = 0; i < NUM_LOOKUPS; i += CHUNK) {
+		size_t n = NUM_LOOKUPS - i < CHUNK ? NUM_LOOKUPS - i : CHUNK;
+		htGetBatch(&ht, &names[i], &lengths[i], n, out);
+		for (size_t j = 0; j < n; ++j)
+			sink -= *(uint64_t *)out[j];
+	}
+	double batch = (now() - start) / NUM_LOOKUPS * 1e9;
+
+	printf("%12zu entries: htGet %7.2f ns/op   htGetBatch %7.2f ns/op   speedup %5.2fx%s\n",
+		size, single, batch, single / batch, sink ? "   (mismatch!)" : "");
+	htFree(&ht);
+	free(lengths);
+	free(names);
+	free(keys);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "--huge") == 0) {
+#if defined(__linux__)
+		params.allocator = &htHugePageAllocator;
+#endif
+		--argc, ++argv;
+	}
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			bench_size(strtoull(argv[i], NULL, 10));
+	} else {
+		bench_size(1000000);
+		bench_size(16000000);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/* Compares ways of filling a table with a known set of 8 byte keys: htSet in a loop,
+ * growing through a rebuild at every doubling, with those rebuilds on one or several
+ * threads, and htBuildFrom sizing the table once. The sizes can be given on the
+ * command line, e.g. 100000000 500000000. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#define HT_OPTION_PARALLEL 1
+#include "hashtable.h"
+
+static int const threadCounts[] = {1, 2, 4, 8};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_size(size_t size)
+{
+	uint64_t *keys = malloc(size * sizeof(*keys));
+	void const **names = malloc(size * sizeof(*names));
+	HT_len *lengths = malloc(size * sizeof(*lengths));
+	for (size_t i = 0; i < size; ++i) {
+		keys[i] = i * 0x9E3779B97F4A7C15ull;
+		names[i] = &keys[i];
+		lengths[i] = sizeof(*keys);
+	}
+	printf("%zu entries:\n", size);
+	for (size_t t = 0; t < sizeof(threadCounts) / sizeof(*threadCounts); ++t) {
+		struct HT_params params = {.threads = threadCounts[t]};
+		double start = now();
+		struct HT ht = htNewWith(1, sizeof(uint64_t), &params);
+		for (size_t i = 0; i < size; ++i)
+			htSet(&ht, &keys[i], sizeof(*keys), &keys[i]);
+		double loop = now() - start;
+		htFree(&ht);
+
+		start = now();
+		ht = htBuildFrom(names, lengths, keys, size, sizeof(uint64_t), &params);
+		double bulk = now() - start;
+		size_t misses = 0;
+		for (size_t i = 0; i < size; i += 97) {
+			uint64_t *value = htGet(&ht, &keys[i], sizeof(*keys));
+			misses += !value || *value != keys[i];
+		}
+		htFree(&ht);
+		printf("  %d threads: htSet loop %7.3f s   htBuildFrom %7.3f s%s\n",
+			threadCounts[t], loop, bulk, misses ? "   (mismatch!)" : "");
+	}
+	free(keys);
+	free(names);
+	free(lengths);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			bench_size(strtoull(argv[i], NULL, 10));
+	} else {
+		bench_size(1000000);
+		bench_size(10000000);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/* Runs Zipf-distributed memoization traces against a bounded cache: every access
+ * looks its key up and stores it on a miss. HT_cache with its built-in CLOCK eviction
+ * is compared against a plain table with an LRU list kept on the side, which needs a
+ * second lookup for every eviction. Reports hit rates and throughput for a few cache
+ * sizes relative to the number of distinct keys. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_KEYS 1000000
+#define NUM_OPS 4000000
+
+static double const exponents[] = {0.8, 0.99, 1.2};
+static double const ratios[] = {0.001, 0.01, 0.1};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* Ranks are scattered over the key space, so that popular keys aren't neighbours. */
+static void make_trace(uint64_t *trace, double exponent)
+{
+	double *cdf = malloc(NUM_KEYS * sizeof(*cdf)), sum = 0;
+	for (size_t i = 0; i < NUM_KEYS; ++i)
+		cdf[i] = sum += pow(i + 1, -exponent);
+	uint64_t state = 88172645463325252ull;
+	for (size_t i = 0; i < NUM_OPS; ++i) {
+		double u = (xorshift(&state) >> 11) * 0x1p-53 * sum;
+		size_t lo = 0, hi = NUM_KEYS - 1;
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		trace[i] = lo * 0x9E3779B97F4A7C15ull;
+	}
+	free(cdf);
+}
+
+static void run_clock(uint64_t const *trace, size_t size, double *hitRate, double *mops)
+{
+	struct HT_cache cache = htCacheNew(size, 0, sizeof(uint64_t), &(struct HT_params){.flags = HT_OWN_KEYS});
+	size_t hits = 0;
+	double start = now();
+	for (size_t i = 0; i < NUM_OPS; ++i) {
+		if (htCacheGet(&cache, &trace[i], sizeof(*trace)) != NULL)
+			++hits;
+		else
+			htCachePut(&cache, &trace[i], sizeof(*trace), &trace[i]);
+	}
+	*mops = NUM_OPS / (now() - start) * 1e-6;
+	*hitRate = (double)hits / NUM_OPS;
+	htCacheFree(&cache);
+}
+
+/* The table maps keys to nodes of a doubly linked list in recency order. */
+struct lru_node
+{
+	uint64_t key;
+	size_t prev, next;
+};
+
+static void lru_unlink(struct lru_node *nodes, size_t n)
+{
+	nodes[nodes[n].prev].next = nodes[n].next;
+	nodes[nodes[n].next].prev = nodes[n].prev;
+}
+
+/* Node 0 is the head of the list. */
+static void lru_push(struct lru_node *nodes, size_t n)
+{
+	nodes[n].prev = 0;
+	nodes[n].next = nodes[0].next;
+	nodes[nodes[0].next].prev = n;
+	nodes[0].next = n;
+}
+
+static void run_lru(uint64_t const *trace, size_t size, double *hitRate, double *mops)
+{
+	struct lru_node *nodes = malloc((size + 1) * sizeof(*nodes));
+	nodes[0].prev = nodes[0].next = 0;
+	size_t used = 0, hits = 0;
+	struct HT ht = htNewWith(size / 0.8 + 1, sizeof(size_t), &(struct HT_params){.flags = HT_OWN_KEYS});
+	double start = now();
+	for (size_t i = 0; i < NUM_OPS; ++i) {
+		size_t *n = htGet(&ht, &trace[i], sizeof(*trace));
+		if (n != NULL) {
+			++hits;
+			lru_unlink(nodes, *n);
+			lru_push(nodes, *n);
+			continue;
+		}
+		size_t node;
+		if (used < size) {
+			node = ++used;
+		} else {
+			node = nodes[0].prev;
+			lru_unlink(nodes, node);
+			htDel(&ht, &nodes[node].key, sizeof(nodes[node].key));
+		}
+		nodes[node].key = trace[i];
+		lru_push(nodes, node);
+		htSet(&ht, &trace[i], sizeof(*trace), &node);
+	}
+	*mops = NUM_OPS / (now() - start) * 1e-6;
+	*hitRate = (double)hits / NUM_OPS;
+	htFree(&ht);
+	free(nodes);
+}
+
+int main()
+{
+	uint64_t *trace = malloc(NUM_OPS * sizeof(*trace));
+	printf("%d accesses to %d keys\n", NUM_OPS, NUM_KEYS);
+	printf("exponent  cache size   clock hits   Mops/s     lru hits   Mops/s\n");
+	for (size_t e = 0; e < sizeof(exponents) / sizeof(*exponents); ++e) {
+		make_trace(trace, exponents[e]);
+		for (size_t r = 0; r < sizeof(ratios) / sizeof(*ratios); ++r) {
+			size_t size = NUM_KEYS * ratios[r];
+			double clockHits, clockMops, lruHits, lruMops;
+			run_clock(trace, size, &clockHits, &clockMops);
+			run_lru(trace, size, &lruHits, &lruMops);
+			printf("%8.2f  %10zu   %9.2f%%  %7.2f   %9.2f%%  %7.2f\n", exponents[e], size,
+				100 * clockHits, clockMops, 100 * lruHits, lruMops);
+		}
+	}
+	free(trace);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/* Times the core calm.h matrix operations over arrays of random matrices, which stay
+ * in cache, and then the batched point transforms on every batch backend, for a batch
+ * that fits in cache and one that doesn't, and the same for batched matrix products,
+ * also split over a few threads. The Makefile builds this once for the
+ * backend chosen by default and once as calm_bench_avx2 with AVX2 and FMA enabled. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define CM_IMPLEMENT_HERE
+#define CM_OPTION_PARALLEL 1
+#include "calm.h"
+
+#define NUM_MATRICES 1024
+#define NUM_ROUNDS 2000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static cm_m16 mats[NUM_MATRICES];
+static cm_v4 vecs[NUM_MATRICES];
+
+/* Each result feeds into the next operation, so nothing can be optimized away. */
+static double bench_dot(void)
+{
+	cm_m16 acc = cm_identity_m16();
+	double start = now();
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		for (int i = 0; i < NUM_MATRICES; i++)
+			acc = cm_dot_m16(mats[i], acc);
+	}
+	double elapsed = now() - start;
+	if (cm_hsum_v4(acc.c[0]) == 42.0f)
+		fputc('\n', stderr);
+	return elapsed / ((double)NUM_ROUNDS * NUM_MATRICES) * 1e9;
+}
+
+static double bench_apply(void)
+{
+	cm_v4 acc = cm_send1_v4(0.0f);
+	double start = now();
+	for (int r = 0; r < NUM_ROUNDS; r++) {
+		for (int i = 0; i < NUM_MATRICES; i++)
+			acc = cm_add_v4(acc, cm_apply_m16(mats[i], vecs[i]));
+	}
+	double elapsed = now() - start;
+	if (cm_hsum_v4(acc) == 42.0f)
+		fputc('\n', stderr);
+	return elapsed / ((double)NUM_ROUNDS * NUM_MATRICES) * 1e9;
+}
+
+static double bench_inverse(void)
+{
+	cm_m16 acc = cm_identity_m16();
+	double start = now();
+	for (int r = 0; r < NUM_ROUNDS / 10; r++) {
+		for (int i = 0; i < NUM_MATRICES; i++)
+			acc = cm_add_m16(acc, cm_inverse_m16(mats[i]));
+	}
+	double elapsed = now() - start;
+	if (cm_hsum_v4(acc.c[0]) == 42.0f)
+		fputc('\n', stderr);
+	return elapsed / ((double)NUM_ROUNDS / 10 * NUM_MATRICES) * 1e9;
+}
+
+static void bench_batches(size_t n)
+{
+	cm_v4 *aos = malloc(n * sizeof(*aos)), *aosOut = malloc(n * sizeof(*aos));
+	cm_f1 *buf = malloc(8 * n * sizeof(*buf));
+	cm_f1 *soa[4], *soaOut[4];
+	for (int r = 0; r < 4; r++) {
+		soa[r] = buf + r * n;
+		soaOut[r] = buf + (4 + r) * n;
+	}
+	for (size_t i = 0; i < n; i++)
+		aos[i] = cm_new_v4(rand() / (cm_f1)RAND_MAX, rand() / (cm_f1)RAND_MAX, rand() / (cm_f1)RAND_MAX, 1.0f);
+	cm_aos_to_soa(aos, soa, n);
+	/* Enough rounds for about 64M points in total. */
+	size_t rounds = ((size_t)1 << 26) / n;
+	cm_m16 m = mats[0];
+	printf("%zu points, ns/point:\n", n);
+
+	double start = now();
+	for (size_t r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < n; i++)
+			aosOut[i] = cm_apply_m16(m, aos[i]);
+	}
+	printf("  cm_apply_m16 loop    %6.2f\n", (now() - start) / ((double)rounds * n) * 1e9);
+
+	static char const *const names[] = {"fallback", "SSE", "AVX2"};
+	int backends[] = {CM_BACKEND, cm_batch_backend()};
+	for (int b = 0; b < (backends[1] != backends[0] ? 2 : 1); b++) {
+		cm_set_batch_backend(backends[b]);
+		double t[4];
+		for (int k = 0; k < 4; k++) {
+			start = now();
+			for (size_t r = 0; r < rounds; r++) {
+				switch (k) {
+				case 0: cm_apply_m16_batch(m, aos, aosOut, n); break;
+				case 1: cm_project_m16_batch(m, aos, aosOut, n); break;
+				case 2: cm_apply_m16_soa(m, (cm_f1 const *const *)soa, soaOut, n); break;
+				case 3: cm_project_m16_soa(m, (cm_f1 const *const *)soa, soaOut, n); break;
+				}
+			}
+			t[k] = (now() - start) / ((double)rounds * n) * 1e9;
+		}
+		printf("  %-8s batches:    apply AoS %6.2f   project AoS %6.2f   apply SoA %6.2f   project SoA %6.2f\n",
+			names[backends[b]], t[0], t[1], t[2], t[3]);
+	}
+	cm_set_batch_backend(backends[1]);
+	free(aos);
+	free(aosOut);
+	free(buf);
+}
+
+static void bench_dot_batches(size_t n)
+{
+	cm_m16 *l = malloc(n * sizeof(*l)), *r = malloc(n * sizeof(*r)), *out = malloc(n * sizeof(*out));
+	for (size_t i = 0; i < n; i++) {
+		l[i] = mats[i % NUM_MATRICES];
+		r[i] = mats[(i * 7) % NUM_MATRICES];
+	}
+	/* Enough rounds for about 16M products in total. */
+	size_t rounds = ((size_t)1 << 24) / n;
+	printf("%zu matrix pairs, ns/product:\n", n);
+
+	double start = now();
+	for (size_t k = 0; k < rounds; k++) {
+		for (size_t i = 0; i < n; i++)
+			out[i] = cm_dot_m16(l[i], r[i]);
+	}
+	printf("  cm_dot_m16 loop      %6.2f\n", (now() - start) / ((double)rounds * n) * 1e9);
+
+	static char const *const names[] = {"fallback", "SSE", "AVX2"};
+	static int const threadCounts[] = {1, 2, 4};
+	int backends[] = {CM_BACKEND, cm_batch_backend()};
+	for (int b = 0; b < (backends[1] != backends[0] ? 2 : 1); b++) {
+		cm_set_batch_backend(backends[b]);
+		printf("  %-8s batches:   ", names[backends[b]]);
+		for (int t = 0; t < 3; t++) {
+			cm_set_batch_threads(threadCounts[t]);
+			start = now();
+			for (size_t k = 0; k < rounds; k++)
+				cm_dot_m16_batch(l, r, out, n);
+			printf(" %d threads %6.2f ", threadCounts[t], (now() - start) / ((double)rounds * n) * 1e9);
+		}
+		printf("\n");
+	}
+	cm_set_batch_backend(backends[1]);
+	cm_set_batch_threads(1);
+	free(l);
+	free(r);
+	free(out);
+}
+
+int main()
+{
+	srand(1234);
+	for (int i = 0; i < NUM_MATRICES; i++) {
+		cm_f1 f[16];
+		for (int j = 0; j < 16; j++)
+			f[j] = rand() / (cm_f1)RAND_MAX * 0.5f - 0.25f;
+		/* Close to the identity, so that products of many of them stay finite. */
+		for (int j = 0; j < 4; j++)
+			f[5 * j] += 0.5f;
+		mats[i] = cm_send_m16(f);
+		vecs[i] = cm_send_v4(f);
+	}
+	static char const *const names[] = {"fallback", "SSE", "AVX2"};
+	printf("backend %s:\n", names[CM_BACKEND]);
+	printf("  cm_dot_m16     %6.2f ns/op\n", bench_dot());
+	printf("  cm_apply_m16   %6.2f ns/op\n", bench_apply());
+	printf("  cm_inverse_m16 %6.2f ns/op\n", bench_inverse());
+	bench_batches(4096);
+	bench_batches(4 << 20);
+	bench_dot_batches(4096);
+	bench_dot_batches(1 << 20);
+	return EXIT_SUCCESS;
+}
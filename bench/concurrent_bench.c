@@ -0,0 +1,100 @@
+/* Measures how the throughput of the concurrent table scales with the number of threads,
+ * compared to a plain table behind a global mutex. Every thread does 90% lookups and
+ * 10% updates on a shared set of keys. The maximum number of threads defaults to the
+ * number of online cores and can be given on the command line. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define HT_IMPLEMENT_HERE
+#define HT_OPTION_CONCURRENT 1
+#include "hashtable.h"
+
+#define NUM_KEYS 1000000
+#define OPS_PER_THREAD 2000000
+
+static uint64_t keys[NUM_KEYS];
+static struct HTC *htc;
+static struct HT ht;
+static pthread_mutex_t ht_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void *run_concurrent(void *arg)
+{
+	uint64_t state = 88172645463325252ull + (uintptr_t)arg, value;
+	for (int i = 0; i < OPS_PER_THREAD; ++i) {
+		uint64_t r = xorshift(&state);
+		uint64_t *key = &keys[r % NUM_KEYS];
+		if (r >> 60 == 0)
+			htcSet(htc, key, sizeof(*key), &r);
+		else
+			htcGet(htc, key, sizeof(*key), &value);
+	}
+	return NULL;
+}
+
+static void *run_locked(void *arg)
+{
+	uint64_t state = 88172645463325252ull + (uintptr_t)arg, value;
+	for (int i = 0; i < OPS_PER_THREAD; ++i) {
+		uint64_t r = xorshift(&state);
+		uint64_t *key = &keys[r % NUM_KEYS];
+		pthread_mutex_lock(&ht_lock);
+		if (r >> 60 == 0)
+			htSet(&ht, key, sizeof(*key), &r);
+		else
+			memcpy(&value, htGet(&ht, key, sizeof(*key)), sizeof(value));
+		pthread_mutex_unlock(&ht_lock);
+	}
+	return NULL;
+}
+
+static double measure(void *(*func)(void *), int threads)
+{
+	pthread_t ids[threads];
+	double start = now();
+	for (intptr_t t = 0; t < threads; ++t)
+		pthread_create(&ids[t], NULL, func, (void *)t);
+	for (int t = 0; t < threads; ++t)
+		pthread_join(ids[t], NULL);
+	return (double)threads * OPS_PER_THREAD / (now() - start) * 1e-6;
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	htc = htcNew(NUM_KEYS / 0.8 + 1, sizeof(uint64_t), &(struct HT_params){0});
+	ht = htNew(NUM_KEYS / 0.8 + 1, sizeof(uint64_t));
+	for (int i = 0; i < NUM_KEYS; ++i) {
+		keys[i] = i * 0x9E3779B97F4A7C15ull;
+		htcSet(htc, &keys[i], sizeof(*keys), &keys[i]);
+		htSet(&ht, &keys[i], sizeof(*keys), &keys[i]);
+	}
+	printf("threads    HTC Mops/s    mutex+HT Mops/s\n");
+	for (int t = 1; t <= max_threads; t *= 2) {
+		printf("%7d %13.2f %18.2f\n", t, measure(run_concurrent, t), measure(run_locked, t));
+		if (t < max_threads && t * 2 > max_threads)
+			t = max_threads / 2;
+	}
+	htcFree(htc);
+	htFree(&ht);
+	return EXIT_SUCCESS;
+}
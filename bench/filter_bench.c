@@ -0,0 +1,86 @@
+/* Measures htHas with and without HT_FILTER for different shares of lookups that miss,
+ * on 16 byte keys. The sizes can be given on the command line, e.g. 1000000 64000000. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_LOOKUPS 4000000
+#define KEY_BYTES 16
+
+static int const missPercents[] = {0, 50, 90, 99, 100};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* Keys below size are in the table, the ones above aren't. */
+static void fill_key(uint64_t *key, size_t i)
+{
+	key[0] = i * 0x9E3779B97F4A7C15ull;
+	key[1] = ~key[0];
+}
+
+static double bench_lookups(struct HT *ht, size_t size, int missPercent)
+{
+	uint64_t state = 88172645463325252ull;
+	size_t found = 0;
+	double start = now();
+	for (size_t n = 0; n < NUM_LOOKUPS; ++n) {
+		uint64_t r = xorshift(&state), key[2];
+		fill_key(key, (r >> 8) % size + (r % 100 < (uint64_t)missPercent ? size : 0));
+		found += htHas(ht, key, KEY_BYTES);
+	}
+	double elapsed = now() - start;
+	/* Keeps the lookups from being optimized away. */
+	if (found == 42)
+		fputc('\n', stderr);
+	return elapsed / NUM_LOOKUPS * 1e9;
+}
+
+static void bench_size(size_t size)
+{
+	struct HT plain = htNewWith(1, 0, &(struct HT_params){.flags = HT_OWN_KEYS});
+	struct HT filtered = htNewWith(1, 0, &(struct HT_params){.flags = HT_OWN_KEYS | HT_FILTER});
+	for (size_t i = 0; i < size; ++i) {
+		uint64_t key[2];
+		fill_key(key, i);
+		htSet(&plain, key, KEY_BYTES, NULL);
+		htSet(&filtered, key, KEY_BYTES, NULL);
+	}
+	printf("%zu entries:\n", size);
+	for (size_t m = 0; m < sizeof(missPercents) / sizeof(*missPercents); ++m) {
+		double without = bench_lookups(&plain, size, missPercents[m]);
+		double with = bench_lookups(&filtered, size, missPercents[m]);
+		printf("  %3d%% misses: plain %7.2f ns/op   filtered %7.2f ns/op   speedup %5.2fx\n",
+			missPercents[m], without, with, without / with);
+	}
+	htFree(&plain);
+	htFree(&filtered);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			bench_size(strtoull(argv[i], NULL, 10));
+	} else {
+		bench_size(100000);
+		bench_size(4000000);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/* Compares lookups in a frozen table against the live table it was frozen from,
+ * along with the time htFreeze takes and the memory both need per entry.
+ * The sizes can be given on the command line, e.g. 1000000 16000000 64000000. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_LOOKUPS 4000000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void bench_size(size_t size)
+{
+	uint64_t *keys = malloc(size * sizeof(*keys));
+	struct HT ht = htNew(1, sizeof(uint64_t));
+	for (size_t i = 0; i < size; ++i) {
+		keys[i] = i * 0x9E3779B97F4A7C15ull;
+		htSet(&ht, &keys[i], sizeof(*keys), &keys[i]);
+	}
+	double start = now();
+	struct HTF htf = htFreeze(&ht);
+	double freeze = now() - start;
+
+	/* Both include the key bytes, which the live table only references. */
+	double liveBytes = (double)ht.cap * (sizeof(struct HT_key) + 1 + ht.eSize) / size + sizeof(*keys);
+	double frozenBytes = ((double)htf.buckets * sizeof(*htf.pilots) + (size + 1) * sizeof(*htf.offsets)
+		+ (htf.range - size) * sizeof(*htf.remap) + htf.offsets[size] + (double)size * htf.eSize) / size;
+
+	uint64_t sink = 0, state = 88172645463325252ull;
+	start = now();
+	for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+		uint64_t *key = &keys[xorshift(&state) % size];
+		sink += *(uint64_t *)htGet(&ht, key, sizeof(*key)) - *key;
+	}
+	double live = (now() - start) / NUM_LOOKUPS * 1e9;
+
+	state = 88172645463325252ull;
+	start = now();
+	for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+		uint64_t *key = &keys[xorshift(&state) % size];
+		sink += *(uint64_t *)htfGet(&htf, key, sizeof(*key)) - *key;
+	}
+	double frozen = (now() - start) / NUM_LOOKUPS * 1e9;
+
+	printf("%12zu entries: htGet %7.2f ns/op %6.1f B/entry   htfGet %7.2f ns/op %6.1f B/entry   htFreeze %6.2f s%s\n",
+		size, live, liveBytes, frozen, frozenBytes, freeze, sink ? "   (mismatch!)" : "");
+	htfFree(&htf);
+	htFree(&ht);
+	free(keys);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			bench_size(strtoull(argv[i], NULL, 10));
+	} else {
+		bench_size(1000000);
+		bench_size(16000000);
+	}
+	return EXIT_SUCCESS;
+}
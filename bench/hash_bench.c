@@ -0,0 +1,127 @@
+/* Compares the built-in hash functions and a caller-supplied one,
+ * both in raw throughput and in the probe lengths they lead to. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#define HT_OPTION_STATS 1
+#include "hashtable.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#	define HAVE_RDTSC 1
+#endif
+
+#define NUM_KEYS 100000
+#define NUM_ROUNDS 20
+
+static HT_hash fnv1a_hash(void const *data, HT_len length, uint64_t seed)
+{
+	unsigned char const *bytes = data;
+	uint32_t hash = 2166136261u ^ (uint32_t)seed;
+	for (HT_len i = 0; i < length; ++i) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct {
+	char const *name;
+	struct HT_params params;
+} const options[] = {
+	{"one-at-a-time", {.hash = htHashOneAtATime}},
+	{"wyhash",        {.hash = htHashWy}},
+	{"wyhash-random", {.hash = htHashWy, .flags = HT_RANDOM_SEED}},
+	{"fnv1a-callback", {.hash = fnv1a_hash}},
+};
+
+static char *names[NUM_KEYS];
+static HT_len lengths[NUM_KEYS];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_keys(void)
+{
+	srand(1234);
+	for (int i = 0; i < NUM_KEYS; ++i) {
+		lengths[i] = 40 + rand() % 161;
+		names[i] = malloc(lengths[i]);
+		for (int j = 0; j < lengths[i]; ++j)
+			names[i][j] = 'a' + rand() % 26;
+	}
+}
+
+static void bench_throughput(char const *name, struct HT_params const *params)
+{
+	struct HT ht = htNewWith(1, 0, params);
+	size_t bytes = 0;
+	HT_hash sink = 0;
+	double start = now();
+#ifdef HAVE_RDTSC
+	uint64_t cycles = __rdtsc();
+#endif
+	for (int r = 0; r < NUM_ROUNDS; ++r) {
+		for (int i = 0; i < NUM_KEYS; ++i) {
+			sink = sink * 31 + ht.hash(names[i], lengths[i], ht.seed);
+			bytes += lengths[i];
+		}
+	}
+#ifdef HAVE_RDTSC
+	cycles = __rdtsc() - cycles;
+#endif
+	double elapsed = now() - start;
+	printf("%-16s %8.3f GB/s", name, bytes / elapsed * 1e-9);
+#ifdef HAVE_RDTSC
+	printf(" %8.3f bytes/cycle", (double)bytes / cycles);
+#endif
+	printf("   (%08x)\n", sink);
+	htFree(&ht);
+}
+
+static void bench_probe_lengths(char const *name, struct HT_params const *params)
+{
+	struct HT ht = htNewWith(16, sizeof(int), params);
+	for (int i = 0; i < NUM_KEYS; ++i)
+		htSet(&ht, names[i], lengths[i], &i);
+	for (int i = 0; i < NUM_KEYS; ++i)
+		htGet(&ht, names[i], lengths[i]);
+	struct HT_stats stats;
+	htStats(&ht, &stats);
+	/* Buckets: 0, 1, 2, 3, 4-7, 8-15, 16+ */
+	size_t hist[7] = {0}, total = 0;
+	for (size_t d = 0; d < HT_STATS_BUCKETS; ++d) {
+		hist[d < 4 ? d : d < 8 ? 4 : d < 16 ? 5 : 6] += stats.displacement[d];
+		total += d * stats.displacement[d];
+	}
+	printf("%-16s mean %5.2f  max %3zu  cmp %4.2f  |", name, (double)total / ht.fill,
+		stats.maxDisplacement, stats.comparesPerLookup);
+	for (int b = 0; b < 7; ++b)
+		printf(" %6.2f%%", 100.0 * hist[b] / ht.fill);
+	printf("\n");
+	htFree(&ht);
+}
+
+int main()
+{
+	int count = sizeof(options) / sizeof(*options);
+	make_keys();
+	printf("== hash throughput (%d keys of 40-200 bytes) ==\n", NUM_KEYS);
+	for (int o = 0; o < count; ++o)
+		bench_throughput(options[o].name, &options[o].params);
+	printf("== probe length distribution ==\n");
+	printf("%48s |       0       1       2       3     4-7    8-15     16+\n", "");
+	for (int o = 0; o < count; ++o)
+		bench_probe_lengths(options[o].name, &options[o].params);
+	for (int i = 0; i < NUM_KEYS; ++i)
+		free(names[i]);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+/* Compares HTO against a plain table on 16 byte keys with 8 byte values: bytes per
+ * entry, a full scan over all values, and lookups. The plain table is scanned slot by
+ * slot, which is what a caller that walks its arrays would have to do. The sizes can be
+ * given on the command line, e.g. 1000000 64000000. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_LOOKUPS 4000000
+#define KEY_BYTES 16
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_key(uint64_t *key, size_t i)
+{
+	key[0] = i * 0x9E3779B97F4A7C15ull;
+	key[1] = ~key[0];
+}
+
+static double scan_plain(struct HT *ht, uint64_t *sum)
+{
+	double start = now();
+	for (size_t i = 0; i < ht->cap; ++i)
+		if (is_live(ht, i))
+			*sum += *(uint64_t *)value_of(ht, i);
+	return now() - start;
+}
+
+static double scan_ordered(struct HTO *hto, uint64_t *sum)
+{
+	size_t cursor = 0;
+	void const *name;
+	HT_len length;
+	void *value;
+	double start = now();
+	while (htoNext(hto, &cursor, &name, &length, &value))
+		*sum += *(uint64_t *)value;
+	return now() - start;
+}
+
+static double lookups(void *table, bool ordered, size_t size, uint64_t *sum)
+{
+	uint64_t key[2];
+	double start = now();
+	for (size_t n = 0; n < NUM_LOOKUPS; ++n) {
+		fill_key(key, n * 7919 % size);
+		uint64_t *value = ordered ? htoGet(table, key, KEY_BYTES) : htGet(table, key, KEY_BYTES);
+		*sum += *value;
+	}
+	return (now() - start) / NUM_LOOKUPS * 1e9;
+}
+
+static void bench_size(size_t size)
+{
+	struct HT plain = htNewWith(1, sizeof(uint64_t), &(struct HT_params){.flags = HT_OWN_KEYS});
+	struct HTO ordered = htoNew(1, sizeof(uint64_t), &(struct HT_params){.flags = HT_OWN_KEYS});
+	for (size_t i = 0; i < size; ++i) {
+		uint64_t key[2];
+		fill_key(key, i);
+		htSet(&plain, key, KEY_BYTES, &i);
+		htoSet(&ordered, key, KEY_BYTES, &i);
+	}
+	double plainBytes = plain.cap * (sizeof(struct HT_key) + plain.slotSize + 1) + plain.arenaFill;
+	double orderedBytes = hto_usable(ordered.cap) * (sizeof(struct HT_key) + ordered.base.eSize)
+		+ ordered.cap * ordered.width + ordered.base.arenaFill;
+	uint64_t sum = 0;
+	double plainScan = scan_plain(&plain, &sum), orderedScan = scan_ordered(&ordered, &sum);
+	double plainLookup = lookups(&plain, false, size, &sum), orderedLookup = lookups(&ordered, true, size, &sum);
+	printf("%zu entries:\n", size);
+	printf("  plain:   %6.1f bytes/entry   scan %6.2f ns/entry   lookup %6.2f ns/op\n",
+		plainBytes / size, plainScan / size * 1e9, plainLookup);
+	printf("  ordered: %6.1f bytes/entry   scan %6.2f ns/entry   lookup %6.2f ns/op   (%d byte indices)\n",
+		orderedBytes / size, orderedScan / size * 1e9, orderedLookup, ordered.width);
+	/* Keeps the scans and lookups from being optimized away. */
+	if (sum == 42)
+		fputc('\n', stderr);
+	htFree(&plain);
+	htoFree(&ordered);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			bench_size(strtoull(argv[i], NULL, 10));
+	} else {
+		bench_size(200);
+		bench_size(50000);
+		bench_size(4000000);
+	}
+	return EXIT_SUCCESS;
+}
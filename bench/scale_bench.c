@@ -0,0 +1,66 @@
+/* Fills a table built with HT_OPTION_WIDE past the old 2^31 slot limit and reports
+ * insertion and lookup cost per entry. The entry count can be given on the command line,
+ * e.g. 4000000000, which needs a machine with around 300 GB of memory: every slot
+ * takes 24 bytes of key, one control byte and the 8 byte value. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define HT_OPTION_WIDE 1
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_LOOKUPS 4000000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void bench_size(size_t size)
+{
+	/* The keys are owned and fit into their slots, so they need no memory of their own. */
+	struct HT ht = htNewWith(size / 0.8 + 1, sizeof(uint64_t), &(struct HT_params){.flags = HT_OWN_KEYS});
+	double start = now();
+	for (uint64_t i = 0; i < size; ++i) {
+		uint64_t key = i * 0x9E3779B97F4A7C15ull;
+		htSet(&ht, &key, sizeof(key), &i);
+	}
+	double insert = (now() - start) / size * 1e9;
+
+	uint64_t state = 88172645463325252ull, misses = 0;
+	start = now();
+	for (size_t n = 0; n < NUM_LOOKUPS; ++n) {
+		uint64_t i = xorshift(&state) % size, key = i * 0x9E3779B97F4A7C15ull;
+		uint64_t *value = htGet(&ht, &key, sizeof(key));
+		misses += !value || *value != i;
+	}
+	double lookup = (now() - start) / NUM_LOOKUPS * 1e9;
+
+	printf("%12zu entries in %12zu slots: htSet %7.2f ns/op   htGet %7.2f ns/op%s\n",
+		ht.fill, ht.cap, insert, lookup, misses ? "   (mismatch!)" : "");
+	htFree(&ht);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			bench_size(strtoull(argv[i], NULL, 10));
+	} else {
+		bench_size(1000000);
+		bench_size(16000000);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+/* Runs parameterized workloads against hashtable.h and prints one tab-separated line per
+ * measurement, so that results can be compared between commits. Keys are 8 or 64 bytes
+ * long, drawn uniformly or from a Zipf distribution out of a universe twice the size of
+ * the table, whose first half the table starts out with. The workloads are:
+ *
+ *   lookup-hit   lookups of keys in the table
+ *   lookup-half  half of them hits, half misses
+ *   lookup-miss  lookups of keys not in the table
+ *   insert       80% insertions or updates, 20% lookups
+ *   delete       80% deletions, 20% lookups
+ *   churn        insertions and deletions in equal parts
+ *
+ * The default sizes range from L1-resident to far beyond the LLC, others can be given
+ * on the command line. A second section compares the latency distribution of single
+ * insertions into a growing table with and without HT_INCREMENTAL. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define HT_IMPLEMENT_HERE
+#include "hashtable.h"
+
+#define NUM_OPS 2000000
+#define ZIPF_EXPONENT 0.99
+
+enum op { OP_GET, OP_SET, OP_DEL };
+
+struct workload
+{
+	char const *name;
+	/* Percentages of lookups that hit, and of operations that insert and delete. */
+	int hits, sets, dels;
+};
+
+static struct workload const workloads[] = {
+	{"lookup-hit", 100, 0, 0},
+	{"lookup-half", 50, 0, 0},
+	{"lookup-miss", 0, 0, 0},
+	{"insert", -1, 80, 0},
+	{"delete", -1, 0, 80},
+	{"churn", -1, 50, 50},
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static double uniform(uint64_t *state)
+{
+	return (xorshift(state) >> 11) * 0x1p-53;
+}
+
+struct keys
+{
+	char *bytes;
+	int length;
+};
+
+static struct keys make_keys(size_t count, int length)
+{
+	struct keys keys = {malloc(count * length), length};
+	for (size_t i = 0; i < count; ++i) {
+		uint64_t x = i * 0x9E3779B97F4A7C15ull;
+		char *key = keys.bytes + i * length;
+		if (length == sizeof(x)) {
+			memcpy(key, &x, sizeof(x));
+		} else {
+			char buf[128];
+			snprintf(buf, sizeof(buf), "%0*llu", length, (unsigned long long)x);
+			memcpy(key, buf, length);
+		}
+	}
+	return keys;
+}
+
+static char *key_at(struct keys const *keys, size_t i)
+{
+	return keys->bytes + i * keys->length;
+}
+
+/* Samples ranks in [0, count), with rank 0 the most frequent for Zipf. */
+struct sampler
+{
+	size_t count;
+	double *cdf;
+};
+
+static struct sampler make_sampler(size_t count, bool zipf)
+{
+	struct sampler sampler = {count, NULL};
+	if (!zipf)
+		return sampler;
+	sampler.cdf = malloc(count * sizeof(*sampler.cdf));
+	double sum = 0;
+	for (size_t i = 0; i < count; ++i)
+		sampler.cdf[i] = sum += pow(i + 1, -ZIPF_EXPONENT);
+	for (size_t i = 0; i < count; ++i)
+		sampler.cdf[i] /= sum;
+	return sampler;
+}
+
+static size_t sample(struct sampler const *sampler, uint64_t *state)
+{
+	if (sampler->cdf == NULL)
+		return xorshift(state) % sampler->count;
+	double u = uniform(state);
+	size_t lo = 0, hi = sampler->count - 1;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (sampler->cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+struct op_record
+{
+	enum op op;
+	size_t key;
+};
+
+/* Lookup workloads pick from the first or second half of the universe to decide between
+ * hits and misses, the others from the whole universe, since its contents change. */
+static void make_ops(struct op_record *ops, struct workload const *w, size_t entries, bool zipf)
+{
+	struct sampler half = make_sampler(entries, zipf), all = make_sampler(2 * entries, zipf);
+	uint64_t state = 88172645463325252ull;
+	for (size_t i = 0; i < NUM_OPS; ++i) {
+		int r = xorshift(&state) % 100;
+		if (w->hits >= 0) {
+			size_t k = sample(&half, &state);
+			ops[i] = (struct op_record){OP_GET, r < w->hits ? k : entries + k};
+		} else {
+			enum op op = r < w->sets ? OP_SET : r < w->sets + w->dels ? OP_DEL : OP_GET;
+			ops[i] = (struct op_record){op, sample(&all, &state)};
+		}
+	}
+	free(half.cdf);
+	free(all.cdf);
+}
+
+static void run(struct workload const *w, struct keys const *keys, size_t entries, bool zipf,
+	struct op_record *ops)
+{
+	make_ops(ops, w, entries, zipf);
+	struct HT ht = htNew(1, sizeof(uint64_t));
+	for (size_t i = 0; i < entries; ++i)
+		htSet(&ht, key_at(keys, i), keys->length, &i);
+
+	uint64_t sink = 0;
+	double start = now();
+	for (size_t i = 0; i < NUM_OPS; ++i) {
+		char *key = key_at(keys, ops[i].key);
+		switch (ops[i].op) {
+		case OP_GET: {
+			uint64_t *value = htGet(&ht, key, keys->length);
+			sink += value != NULL ? *value : 1;
+			break;
+		}
+		case OP_SET:
+			htSet(&ht, key, keys->length, &i);
+			break;
+		case OP_DEL:
+			htDel(&ht, key, keys->length);
+			break;
+		}
+	}
+	double elapsed = now() - start;
+	printf("%s\t%s\t%d\t%zu\t%.2f\t%.2f\n", w->name, zipf ? "zipf" : "uniform", keys->length,
+		entries, elapsed / NUM_OPS * 1e9, NUM_OPS / elapsed * 1e-6);
+	/* Keeps the lookups from being optimized away. */
+	if (sink == 42)
+		fputc('\n', stderr);
+	htFree(&ht);
+}
+
+static int compare_doubles(void const *a, void const *b)
+{
+	double x = *(double const *)a, y = *(double const *)b;
+	return (x > y) - (x < y);
+}
+
+static void run_latency(struct keys const *keys, size_t entries, unsigned flags)
+{
+	double *latencies = malloc(entries * sizeof(*latencies));
+	struct HT ht = htNewWith(1, sizeof(uint64_t), &(struct HT_params){.flags = flags});
+	for (size_t i = 0; i < entries; ++i) {
+		double start = now();
+		htSet(&ht, key_at(keys, i), keys->length, &i);
+		latencies[i] = (now() - start) * 1e9;
+	}
+	qsort(latencies, entries, sizeof(*latencies), compare_doubles);
+	printf("%s\t%d\t%zu\t%.0f\t%.0f\t%.0f\t%.0f\n", flags & HT_INCREMENTAL ? "incremental" : "rebuild",
+		keys->length, entries, latencies[entries / 2], latencies[entries * 99 / 100],
+		latencies[entries * 999 / 1000], latencies[entries - 1]);
+	htFree(&ht);
+	free(latencies);
+}
+
+int main(int argc, char **argv)
+{
+	size_t defaults[] = {500, 20000, 250000, 4000000};
+	size_t count = argc > 1 ? (size_t)argc - 1 : sizeof(defaults) / sizeof(*defaults);
+	size_t *sizes = defaults, maxSize = 0;
+	if (argc > 1) {
+		sizes = malloc(count * sizeof(*sizes));
+		for (size_t i = 0; i < count; ++i)
+			sizes[i] = strtoull(argv[i + 1], NULL, 10);
+	}
+	for (size_t i = 0; i < count; ++i)
+		maxSize = sizes[i] > maxSize ? sizes[i] : maxSize;
+
+	struct op_record *ops = malloc(NUM_OPS * sizeof(*ops));
+	printf("# workload\tdist\tkey_bytes\tentries\tns_per_op\tmops_per_s\n");
+	for (int length = 8; length <= 64; length *= 8) {
+		struct keys keys = make_keys(2 * maxSize, length);
+		for (size_t s = 0; s < count; ++s) {
+			for (size_t w = 0; w < sizeof(workloads) / sizeof(*workloads); ++w) {
+				run(&workloads[w], &keys, sizes[s], false, ops);
+				run(&workloads[w], &keys, sizes[s], true, ops);
+			}
+		}
+		free(keys.bytes);
+	}
+	free(ops);
+
+	printf("# resize\tkey_bytes\tentries\tp50_ns\tp99_ns\tp999_ns\tmax_ns\n");
+	struct keys keys = make_keys(maxSize, 8);
+	run_latency(&keys, maxSize, 0);
+	run_latency(&keys, maxSize, HT_INCREMENTAL);
+	free(keys.bytes);
+	if (sizes != defaults)
+		free(sizes);
+	return EXIT_SUCCESS;
+}
@@ -29,26 +29,42 @@
 #ifndef CM_CALM_H
 #define CM_CALM_H
 
-typedef float cm_f1;
+#include <stddef.h>
 
-// TEMP
-#define CM_BACKEND 0
+typedef float cm_f1;
 
 #define CM_BACKEND_FALLBACK	0
 #define CM_BACKEND_SSE		1
+/* SSE with fused multiply-adds, and 256-bit registers where two vectors fit. */
+#define CM_BACKEND_AVX2		2
 
 /* If the user didn't supply a CM_BACKEND, then choose automatically. */
 #ifndef CM_BACKEND
-#	if defined(__SSE__) || _M_IX86_FP > 0 || _M_X64 > 0
+#	if defined(__AVX2__) && defined(__FMA__)
+#		define CM_BACKEND CM_BACKEND_AVX2
+#	elif defined(__SSE__) || _M_IX86_FP > 0 || _M_X64 > 0
 #		define CM_BACKEND CM_BACKEND_SSE
 #	else
 #		define CM_BACKEND CM_BACKEND_FALLBACK
 #	endif
 #endif
 
-#if CM_BACKEND == CM_BACKEND_SSE
-#error "SSE SHOULD BE DISABLED RIGHT NOW!"
-#	include <xmmintrin.h>
+/* With the SSE backend, batch functions can still switch to AVX2 kernels at runtime.
+ * This needs GCC or Clang, for the target attribute and the CPU feature checks. */
+#ifndef CM_OPTION_DISPATCH
+#	if CM_BACKEND == CM_BACKEND_SSE && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#		define CM_OPTION_DISPATCH 1
+#	else
+#		define CM_OPTION_DISPATCH 0
+#	endif
+#endif
+
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+#	if CM_BACKEND == CM_BACKEND_AVX2 || CM_OPTION_DISPATCH
+#		include <immintrin.h>
+#	else
+#		include <xmmintrin.h>
+#	endif
 	typedef __m128 cm_f4_;
 #	if defined(_MSC_VER)
 #		define CM_DEF	_vectorcall
@@ -80,6 +96,10 @@ CM_DEF cm_v4  cm_send1_v4(cm_f1 a);
 CM_DEF cm_v4  cm_add_v4(cm_v4 l, cm_v4 r);
 CM_DEF cm_v4  cm_sub_v4(cm_v4 l, cm_v4 r);
 CM_DEF cm_v4  cm_mul_v4(cm_v4 l, cm_v4 r);
+/* Returns l * r + a, rounded only once where the backend has fused multiply-adds. */
+CM_DEF cm_v4  cm_madd_v4(cm_v4 l, cm_v4 r, cm_v4 a);
+/* Returns a vector with all four components set to component i of f. */
+CM_DEF cm_v4  cm_spread_v4(cm_v4 f, int i);
 CM_DEF void   cm_recv_v4(cm_v4 f, cm_f1 o[4]);
 CM_DEF cm_f1  cm_hsum_v4(cm_v4 f);
 CM_DEF cm_v4  cm_scale_v4(cm_v4 f, cm_f1 s);
@@ -125,21 +145,86 @@ CM_DEF cm_qt  cm_cum_qt(cm_qt a, cm_qt b);
 CM_DEF cm_qt  cm_slerp_qt(cm_qt a, cm_qt b, cm_f1 t);
 CM_DEF cm_m16 cm_qt_to_m16(cm_qt q);
 
+/* Batch functions pick their kernel when they are called, so that a binary built
+ * for the SSE backend still uses AVX2 and FMA on CPUs that have them.
+ * cm_batch_backend returns the CM_BACKEND_* they currently use.
+ * cm_set_batch_backend overrides that for testing and benchmarking; backends that
+ * weren't compiled in or that the CPU doesn't support are ignored. */
+int cm_batch_backend(void);
+void cm_set_batch_backend(int backend);
+
+/* out[i] = cm_apply_m16(m, in[i]) for n points. in and out may be the same array.
+ * Outputs of CM_STREAM_BYTES or more are written around the cache. */
+void cm_apply_m16_batch(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n);
+/* The same, followed by the perspective divide: each point becomes (x/w, y/w, z/w, 1/w). */
+void cm_project_m16_batch(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n);
+/* Variants for points stored as one array per component, x, y, z and w. in[3] may be
+ * NULL for points that all have w = 1, and out[3] may be NULL if w isn't needed.
+ * Each output array has to be either the same as its input array or not overlap it. */
+void cm_apply_m16_soa(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n);
+void cm_project_m16_soa(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n);
+/* Convert between the two layouts. out[3] and in[3] may be NULL as above. */
+void cm_aos_to_soa(cm_v4 const *in, cm_f1 *const out[4], size_t n);
+void cm_soa_to_aos(cm_f1 const *const in[4], cm_v4 *out, size_t n);
+
+/* out[i] = cm_dot_m16(l[i], r[i]) for n pairs. out may be the same array as l or r. */
+void cm_dot_m16_batch(cm_m16 const *l, cm_m16 const *r, cm_m16 *out, size_t n);
+/* out[i] = cm_dot_m16(mats[parent[i]], local[i]), e.g. world transforms from local ones.
+ * mats may overlap out, typically by being out itself, as long as every parent in out
+ * comes before its children; roots can point at an identity matrix kept in mats.
+ * That case is never split across threads. */
+void cm_dot_m16_indexed(cm_m16 const *mats, size_t const *parent, cm_m16 const *local, cm_m16 *out, size_t n);
+/* With CM_OPTION_PARALLEL, how many threads the two functions above may use for
+ * batches of at least CM_PARALLEL_MIN matrices. One by default, and at most CM_MAX_THREADS. */
+void cm_set_batch_threads(int threads);
+
 #endif
 
 #ifdef CM_IMPLEMENT_HERE
 
 #include <math.h>
+#include <float.h>
+#include <stdint.h>
 #include <string.h> /* For memcpy only. TODO get rid of this dependency */
 
-#if CM_BACKEND == CM_BACKEND_SSE
+/* Batches writing at least this many bytes use non-temporal stores, which don't
+ * push everything else out of the cache for data that won't fit anyway. */
+#ifndef CM_STREAM_BYTES
+#	define CM_STREAM_BYTES (8 << 20)
+#endif
+
+/* Below this many matrices, starting threads costs more than it saves. */
+#ifndef CM_PARALLEL_MIN
+#	define CM_PARALLEL_MIN 16384
+#endif
+
+/* cm_set_batch_threads clamps its argument to this. */
+#ifndef CM_MAX_THREADS
+#	define CM_MAX_THREADS 64
+#endif
+
+#if CM_OPTION_PARALLEL
+#	include <pthread.h>
+#endif
+
+/* cm_inverse_m16 gives up on matrices whose determinant is negligible next to the
+ * product of the lengths of their columns, which bounds it. Unlike a threshold on the
+ * determinant or on the pivots alone, that doesn't depend on how each column is scaled. */
+#define CM_SINGULAR_RATIO (64 * FLT_EPSILON)
+
+static int cm_negligible_det_(double det, cm_f1 const squaredLengths[4]) {
+	double bound = (double)squaredLengths[0] * squaredLengths[1] * squaredLengths[2] * squaredLengths[3];
+	return det * det <= CM_SINGULAR_RATIO * CM_SINGULAR_RATIO * bound;
+}
+
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
 
 CM_DEF cm_v4 cm_new_v4(cm_f1 a, cm_f1 b, cm_f1 c, cm_f1 d) {
 	return _mm_setr_ps(a, b, c, d);
 }
 
 CM_DEF cm_v4 cm_send_v4(cm_f1 c[4]) {
-	return _mm_setr_ps(c[0], c[1], c[2], c[3]);
+	return _mm_loadu_ps(c);
 }
 
 CM_DEF cm_v4 cm_send1_v4(cm_f1 a) {
@@ -158,12 +243,44 @@ CM_DEF cm_v4 cm_mul_v4(cm_v4 l, cm_v4 r) {
 	return _mm_mul_ps(l, r);
 }
 
-#define cm_spread_v4(f, i) _mm_shuffle_ps(f, f, _MM_SHUFFLE(i, i, i, i))
+#if CM_BACKEND == CM_BACKEND_AVX2
+#	define cm_msub_v4_(l, r, s) _mm_fmsub_ps(l, r, s)
+CM_DEF cm_v4 cm_madd_v4(cm_v4 l, cm_v4 r, cm_v4 a) {
+	return _mm_fmadd_ps(l, r, a);
+}
+#else
+/* l * r - s */
+#	define cm_msub_v4_(l, r, s) _mm_sub_ps(_mm_mul_ps(l, r), s)
+CM_DEF cm_v4 cm_madd_v4(cm_v4 l, cm_v4 r, cm_v4 a) {
+	return _mm_add_ps(_mm_mul_ps(l, r), a);
+}
+#endif
+
+/* The shuffle needs an immediate, so this only turns into a single instruction
+ * where i is known at compile time and the call gets inlined. */
+CM_DEF cm_v4 cm_spread_v4(cm_v4 f, int i) {
+	switch (i) {
+	case 0: return _mm_shuffle_ps(f, f, _MM_SHUFFLE(0, 0, 0, 0));
+	case 1: return _mm_shuffle_ps(f, f, _MM_SHUFFLE(1, 1, 1, 1));
+	case 2: return _mm_shuffle_ps(f, f, _MM_SHUFFLE(2, 2, 2, 2));
+	default: return _mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+}
 
 CM_DEF void cm_recv_v4(cm_v4 f, cm_f1 o[4]) {
-	CM_ALIGN16 cm_f1 i[4];
-	_mm_store_ps(i, f);
-	memcpy(o, i, sizeof(cm_f1[4]));
+	_mm_storeu_ps(o, f);
+}
+
+CM_DEF cm_f1 cm_hsum_v4(cm_v4 f) {
+	cm_v4 s = _mm_add_ps(f, _mm_movehl_ps(f, f));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+	return _mm_cvtss_f32(s);
+}
+
+CM_DEF cm_f1 cm_hsum_v3(cm_v4 f) {
+	cm_v4 s = _mm_add_ss(f, _mm_shuffle_ps(f, f, _MM_SHUFFLE(1, 1, 1, 1)));
+	s = _mm_add_ss(s, _mm_movehl_ps(f, f));
+	return _mm_cvtss_f32(s);
 }
 
 CM_DEF cm_m16 cm_transpose_m16(cm_m16 m) {
@@ -180,6 +297,109 @@ CM_DEF cm_v4 cm_cross_v3(cm_v4 l, cm_v4 r) {
 	return cm_sub_v4(cm_mul_v4(lyzx, rzxy), cm_mul_v4(ryzx, lzxy));
 }
 
+#define CM_SWIZZLE_(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+
+/* cm_inverse_m16 works on 2x2 matrices, stored row by row in one vector. */
+
+/* l * r */
+static cm_v4 cm_mul_m4_(cm_v4 l, cm_v4 r) {
+	return cm_madd_v4(l, CM_SWIZZLE_(r, 0, 3, 0, 3),
+		_mm_mul_ps(CM_SWIZZLE_(l, 1, 0, 3, 2), CM_SWIZZLE_(r, 2, 1, 2, 1)));
+}
+
+/* adj(l) * r */
+static cm_v4 cm_adj_mul_m4_(cm_v4 l, cm_v4 r) {
+	return cm_msub_v4_(CM_SWIZZLE_(l, 3, 3, 0, 0), r,
+		_mm_mul_ps(CM_SWIZZLE_(l, 1, 1, 2, 2), CM_SWIZZLE_(r, 2, 3, 0, 1)));
+}
+
+/* l * adj(r) */
+static cm_v4 cm_mul_adj_m4_(cm_v4 l, cm_v4 r) {
+	return cm_msub_v4_(l, CM_SWIZZLE_(r, 3, 0, 3, 0),
+		_mm_mul_ps(CM_SWIZZLE_(l, 1, 0, 3, 2), CM_SWIZZLE_(r, 2, 1, 2, 1)));
+}
+
+CM_DEF cm_m16 cm_inverse_m16(cm_m16 m) {
+	/* Blockwise inversion over the four 2x2 submatrices A B / C D, after Eric Zhang's
+	 * "Fast 4x4 Matrix Inverse with SSE SIMD, Explained". Works the same whether the
+	 * vectors are taken as rows or columns, since inverse(transpose(M)) = transpose(inverse(M)). */
+	cm_v4 a = _mm_movelh_ps(m.c[0], m.c[1]);
+	cm_v4 b = _mm_movehl_ps(m.c[1], m.c[0]);
+	cm_v4 c = _mm_movelh_ps(m.c[2], m.c[3]);
+	cm_v4 d = _mm_movehl_ps(m.c[3], m.c[2]);
+	/* The determinants of A, B, C and D. */
+	cm_v4 dets = _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(m.c[0], m.c[2], _MM_SHUFFLE(2, 0, 2, 0)),
+			_mm_shuffle_ps(m.c[1], m.c[3], _MM_SHUFFLE(3, 1, 3, 1))),
+		_mm_mul_ps(_mm_shuffle_ps(m.c[0], m.c[2], _MM_SHUFFLE(3, 1, 3, 1)),
+			_mm_shuffle_ps(m.c[1], m.c[3], _MM_SHUFFLE(2, 0, 2, 0))));
+	cm_v4 detA = cm_spread_v4(dets, 0), detB = cm_spread_v4(dets, 1);
+	cm_v4 detC = cm_spread_v4(dets, 2), detD = cm_spread_v4(dets, 3);
+	cm_v4 dc = cm_adj_mul_m4_(d, c);
+	cm_v4 ab = cm_adj_mul_m4_(a, b);
+	cm_v4 x = cm_msub_v4_(detD, a, cm_mul_m4_(b, dc));
+	cm_v4 w = cm_msub_v4_(detA, d, cm_mul_m4_(c, ab));
+	cm_v4 y = cm_msub_v4_(detB, c, cm_mul_adj_m4_(d, ab));
+	cm_v4 z = cm_msub_v4_(detC, b, cm_mul_adj_m4_(a, dc));
+	/* det(M) = det(A) det(D) + det(B) det(C) - tr(adj(A) B adj(D) C) */
+	cm_v4 tr = _mm_mul_ps(ab, CM_SWIZZLE_(dc, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, _mm_movehl_ps(tr, tr));
+	tr = _mm_add_ps(tr, CM_SWIZZLE_(tr, 1, 0, 1, 0));
+	cm_v4 det = _mm_sub_ps(cm_madd_v4(detA, detD, _mm_mul_ps(detB, detC)), cm_spread_v4(tr, 0));
+	cm_v4 s0 = _mm_mul_ps(m.c[0], m.c[0]), s1 = _mm_mul_ps(m.c[1], m.c[1]);
+	cm_v4 s2 = _mm_mul_ps(m.c[2], m.c[2]), s3 = _mm_mul_ps(m.c[3], m.c[3]);
+	_MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+	cm_f1 squaredLengths[4];
+	_mm_storeu_ps(squaredLengths, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+	if (cm_negligible_det_(_mm_cvtss_f32(det), squaredLengths))
+		return cm_identity_m16();
+	cm_v4 rdet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+	x = _mm_mul_ps(x, rdet);
+	y = _mm_mul_ps(y, rdet);
+	z = _mm_mul_ps(z, rdet);
+	w = _mm_mul_ps(w, rdet);
+	return (cm_m16){{
+		_mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)),
+		_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)),
+		_mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)),
+		_mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2))}};
+}
+
+CM_DEF cm_qt cm_cum_qt(cm_qt a, cm_qt b) {
+	/* The same terms as in the fallback, grouped by which components they take. */
+	cm_v4 t0 = _mm_mul_ps(cm_spread_v4(b, 3), a);
+	cm_v4 t1 = _mm_mul_ps(CM_SWIZZLE_(b, 0, 1, 2, 0), CM_SWIZZLE_(a, 3, 3, 3, 0));
+	cm_v4 t2 = _mm_mul_ps(CM_SWIZZLE_(b, 1, 2, 0, 1), CM_SWIZZLE_(a, 2, 0, 1, 1));
+	cm_v4 t3 = _mm_mul_ps(CM_SWIZZLE_(b, 2, 0, 1, 2), CM_SWIZZLE_(a, 1, 2, 0, 2));
+	/* Flips the sign of the w component, which subtracts those terms instead. */
+	cm_v4 flipW = _mm_setr_ps(0.0f, 0.0f, 0.0f, -0.0f);
+	return _mm_sub_ps(_mm_add_ps(t0, _mm_xor_ps(_mm_add_ps(t1, t2), flipW)), t3);
+}
+
+#undef CM_SWIZZLE_
+#undef cm_msub_v4_
+
+#if CM_BACKEND == CM_BACKEND_AVX2
+#	define CM_BACKEND_DOT_M16
+
+/* Two columns of the result at a time, with each column of l repeated in both halves. */
+CM_DEF cm_m16 cm_dot_m16(cm_m16 l, cm_m16 r) {
+	__m256 l0 = _mm256_broadcast_ps(&l.c[0]), l1 = _mm256_broadcast_ps(&l.c[1]);
+	__m256 l2 = _mm256_broadcast_ps(&l.c[2]), l3 = _mm256_broadcast_ps(&l.c[3]);
+	cm_m16 o;
+	for (int c = 0; c < 4; c += 2) {
+		__m256 rc = _mm256_insertf128_ps(_mm256_castps128_ps256(r.c[c]), r.c[c + 1], 1);
+		__m256 oc = _mm256_mul_ps(l0, _mm256_permute_ps(rc, 0x00));
+		oc = _mm256_fmadd_ps(l1, _mm256_permute_ps(rc, 0x55), oc);
+		oc = _mm256_fmadd_ps(l2, _mm256_permute_ps(rc, 0xAA), oc);
+		oc = _mm256_fmadd_ps(l3, _mm256_permute_ps(rc, 0xFF), oc);
+		o.c[c] = _mm256_castps256_ps128(oc);
+		o.c[c + 1] = _mm256_extractf128_ps(oc, 1);
+	}
+	return o;
+}
+#endif
+
 #else // CM_BACKEND == CM_BACKEND_FALLBACK
 
 CM_DEF cm_v4 cm_new_v4(cm_f1 a, cm_f1 b, cm_f1 c, cm_f1 d) {
@@ -210,10 +430,23 @@ CM_DEF cm_v4 cm_mul_v4(cm_v4 l, cm_v4 r) {
 	return (cm_v4){{l.c[0]*r.c[0], l.c[1]*r.c[1], l.c[2]*r.c[2], l.c[3]*r.c[3]}};
 }
 
+CM_DEF cm_v4 cm_madd_v4(cm_v4 l, cm_v4 r, cm_v4 a) {
+	return (cm_v4){{l.c[0]*r.c[0] + a.c[0], l.c[1]*r.c[1] + a.c[1],
+		l.c[2]*r.c[2] + a.c[2], l.c[3]*r.c[3] + a.c[3]}};
+}
+
 CM_DEF cm_v4 cm_spread_v4(cm_v4 f, int i) {
 	return (cm_v4){{f.c[i], f.c[i], f.c[i], f.c[i]}};
 }
 
+CM_DEF cm_f1 cm_hsum_v4(cm_v4 f) {
+	return f.c[0] + f.c[1] + f.c[2] + f.c[3];
+}
+
+CM_DEF cm_f1 cm_hsum_v3(cm_v4 f) {
+	return f.c[0] + f.c[1] + f.c[2];
+}
+
 CM_DEF cm_v4 cm_cross_v3(cm_v4 l, cm_v4 r) {
 	return (cm_v4){{
 		l.c[1]*r.c[2] - l.c[2]*r.c[1],
@@ -260,6 +493,11 @@ CM_DEF cm_m16 cm_inverse_m16(cm_m16 mat) {
 	int colIdx[4] = {0}, rowIdx[4] = {0};
 	int pivotIdx[4] = {-1, -1, -1, -1};
 	int icol = 0, irow = 0;
+	cm_f1 squaredLengths[4];
+	for (int i = 0; i < 4; i++)
+		squaredLengths[i] = cm_dot_v4(mat.c[i], mat.c[i]);
+	/* Up to its sign, the determinant is the product of the pivots. */
+	double det = 1.0;
 	for (int i = 0; i < 4; i++) {
 		// Find the largest pivot value
 		cm_f1 maxPivot = 0.0f;
@@ -278,6 +516,10 @@ CM_DEF cm_m16 cm_inverse_m16(cm_m16 mat) {
 				}
 			}
 		}
+		// check for singular matrix, where irow and icol would still be left over
+		if (maxPivot == 0.0f) {
+			return cm_identity_m16();
+		}
 		pivotIdx[icol]++;
 		// Swap rows over so pivot is on diagonal
 		if (irow != icol) {
@@ -287,10 +529,7 @@ CM_DEF cm_m16 cm_inverse_m16(cm_m16 mat) {
 		}
 		rowIdx[i] = irow, colIdx[i] = icol;
 		cm_f1 pivot = mat.c[icol].c[icol];
-		// check for singular matrix
-		if (pivot == 0.0f) {
-			return cm_identity_m16();
-		}
+		det *= pivot;
 		// Scale row so it has a unit diagonal
 		mat.c[icol].c[icol] = 1.0f;
 		mat.c[icol] = cm_scale_v4(mat.c[icol], 1.0f / pivot);
@@ -304,6 +543,8 @@ CM_DEF cm_m16 cm_inverse_m16(cm_m16 mat) {
 			}
 		}
 	}
+	if (cm_negligible_det_(det, squaredLengths))
+		return cm_identity_m16();
 	for (int j = 3; j >= 0; --j) {
 		int ir = rowIdx[j], ic = colIdx[j];
 		for (int k = 0; k < 4; ++k) {
@@ -327,11 +568,6 @@ CM_DEF cm_qt cm_cum_qt(cm_qt a, cm_qt b) {
 
 /* ~~~~ 4D VECTORS ~~~~ */
 
-CM_DEF cm_f1 cm_hsum_v4(cm_v4 f) {
-	cm_f1 c[4];
-	cm_recv_v4(f, c);
-	return c[0] + c[1] + c[2] + c[3];
-}
 CM_DEF cm_v4 cm_scale_v4(cm_v4 f, cm_f1 s) {
 	cm_v4 b = cm_send1_v4(s);
 	return cm_mul_v4(f, b);
@@ -359,11 +595,6 @@ CM_DEF cm_v4 cm_norm_v3(cm_v4 v) {
 	cm_f1 length = cm_length_v3(v);
 	return cm_scale_v4(v, 1.0 / length);
 }
-CM_DEF cm_f1 cm_hsum_v3(cm_v4 f) {
-	cm_f1 c[4];
-	cm_recv_v4(f, c);
-	return c[0] + c[1] + c[2];
-}
 
 /* ~~~~ 4x4 MATRICES ~~~~ */
 
@@ -413,23 +644,24 @@ CM_DEF cm_m16 cm_sub_m16(cm_m16 l, cm_m16 r) {
 }
 
 CM_DEF cm_v4 cm_apply_m16(cm_m16 m, cm_v4 f) {
-	cm_v4 c0 = cm_mul_v4(m.c[0], cm_spread_v4(f, 0));
-	cm_v4 c1 = cm_mul_v4(m.c[1], cm_spread_v4(f, 1));
-	cm_v4 c2 = cm_mul_v4(m.c[2], cm_spread_v4(f, 2));
-	cm_v4 c3 = cm_mul_v4(m.c[3], cm_spread_v4(f, 3));
-	return cm_add_v4(cm_add_v4(c0, c1), cm_add_v4(c2, c3));
+	/* Two independent chains, so that the multiply-adds don't all wait on each other. */
+	cm_v4 c01 = cm_madd_v4(m.c[1], cm_spread_v4(f, 1), cm_mul_v4(m.c[0], cm_spread_v4(f, 0)));
+	cm_v4 c23 = cm_madd_v4(m.c[3], cm_spread_v4(f, 3), cm_mul_v4(m.c[2], cm_spread_v4(f, 2)));
+	return cm_add_v4(c01, c23);
 }
 
+#ifndef CM_BACKEND_DOT_M16
 CM_DEF cm_m16 cm_dot_m16(cm_m16 l, cm_m16 r) {
 	cm_m16 o;
 	for (int c = 0; c < 4; c++) {
-		o.c[c] =                   cm_mul_v4(l.c[0], cm_spread_v4(r.c[c], 0));
-		o.c[c] = cm_add_v4(o.c[c], cm_mul_v4(l.c[1], cm_spread_v4(r.c[c], 1)));
-		o.c[c] = cm_add_v4(o.c[c], cm_mul_v4(l.c[2], cm_spread_v4(r.c[c], 2)));
-		o.c[c] = cm_add_v4(o.c[c], cm_mul_v4(l.c[3], cm_spread_v4(r.c[c], 3)));
+		o.c[c] = cm_mul_v4(l.c[0], cm_spread_v4(r.c[c], 0));
+		o.c[c] = cm_madd_v4(l.c[1], cm_spread_v4(r.c[c], 1), o.c[c]);
+		o.c[c] = cm_madd_v4(l.c[2], cm_spread_v4(r.c[c], 2), o.c[c]);
+		o.c[c] = cm_madd_v4(l.c[3], cm_spread_v4(r.c[c], 3), o.c[c]);
 	}
 	return o;
 }
+#endif
 
 CM_DEF cm_m16 cm_translate_m16(cm_m16 m, cm_v4 f) {
 	cm_m16 o = m; /* TODO check whether this really copies the underlying __m128's. */
@@ -575,5 +807,493 @@ CM_DEF cm_m16 cm_qt_to_m16(cm_qt q) {
 	return cm_dot_m16(a, b);
 }
 
+/* ~~~~ BATCHES ~~~~ */
+
+static int cm_batch_override_ = -1;
+
+static int cm_best_backend_(void) {
+#if CM_OPTION_DISPATCH
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return CM_BACKEND_AVX2;
+#endif
+	return CM_BACKEND;
+}
+
+int cm_batch_backend(void) {
+	return cm_batch_override_ >= 0 ? cm_batch_override_ : cm_best_backend_();
+}
+
+void cm_set_batch_backend(int backend) {
+	if (backend == CM_BACKEND || backend == cm_best_backend_())
+		cm_batch_override_ = backend;
+}
+
+#if CM_BACKEND == CM_BACKEND_AVX2
+#	define CM_AVX2_KERNELS_ 1
+#	define CM_AVX2_TARGET_
+#elif CM_OPTION_DISPATCH
+#	define CM_AVX2_KERNELS_ 1
+#	define CM_AVX2_TARGET_ __attribute__((target("avx2,fma")))
+#else
+#	define CM_AVX2_KERNELS_ 0
+#endif
+
+static cm_v4 cm_project_v4_(cm_v4 p) {
+	cm_f1 c[4];
+	cm_recv_v4(p, c);
+	cm_f1 rw = 1.0f / c[3];
+	return cm_new_v4(c[0] * rw, c[1] * rw, c[2] * rw, rw);
+}
+
+/* Points [from, to) of a batch, one at a time. These also do the odd ends for the SIMD kernels. */
+static void cm_apply_aos_scalar_(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t from, size_t to, int project) {
+	for (size_t i = from; i < to; i++) {
+		cm_v4 p = cm_apply_m16(m, in[i]);
+		out[i] = project ? cm_project_v4_(p) : p;
+	}
+}
+
+static void cm_apply_soa_scalar_(cm_f1 const mf[16], cm_f1 const *const in[4], cm_f1 *const out[4],
+	size_t from, size_t to, int project) {
+	for (size_t i = from; i < to; i++) {
+		cm_f1 p[4] = {in[0][i], in[1][i], in[2][i], in[3] != NULL ? in[3][i] : 1.0f}, o[4];
+		for (int r = 0; r < 4; r++)
+			o[r] = mf[r] * p[0] + mf[4 + r] * p[1] + mf[8 + r] * p[2] + mf[12 + r] * p[3];
+		if (project) {
+			cm_f1 rw = 1.0f / o[3];
+			o[0] *= rw, o[1] *= rw, o[2] *= rw, o[3] = rw;
+		}
+		for (int r = 0; r < 4; r++) {
+			if (out[r] != NULL)
+				out[r][i] = o[r];
+		}
+	}
+}
+
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+
+/* The number of leading points that have to be done one by one until all of out is
+ * aligned to align bytes, or SIZE_MAX if that never happens. */
+static size_t cm_soa_head_(cm_f1 *const out[4], size_t align) {
+	uintptr_t mis = (uintptr_t)out[0] % align;
+	for (int r = 1; r < 4; r++) {
+		if (out[r] != NULL && (uintptr_t)out[r] % align != mis)
+			return SIZE_MAX;
+	}
+	if (mis % sizeof(cm_f1) != 0)
+		return SIZE_MAX;
+	return (align - mis) % align / sizeof(cm_f1);
+}
+
+static void cm_apply_aos_sse_(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n, int project) {
+	int stream = n * sizeof(cm_v4) >= CM_STREAM_BYTES;
+	for (size_t i = 0; i < n; i++) {
+		cm_v4 p = in[i];
+		cm_v4 o = _mm_mul_ps(m.c[0], cm_spread_v4(p, 0));
+		o = cm_madd_v4(m.c[1], cm_spread_v4(p, 1), o);
+		o = cm_madd_v4(m.c[2], cm_spread_v4(p, 2), o);
+		o = cm_madd_v4(m.c[3], cm_spread_v4(p, 3), o);
+		if (project) {
+			cm_v4 rw = _mm_div_ps(_mm_set1_ps(1.0f), cm_spread_v4(o, 3));
+			cm_v4 d = _mm_mul_ps(o, rw);
+			/* (x/w, y/w) from d, then z/w from d and 1/w from rw. */
+			o = _mm_shuffle_ps(d, _mm_shuffle_ps(d, rw, _MM_SHUFFLE(3, 3, 2, 2)), _MM_SHUFFLE(2, 0, 1, 0));
+		}
+		if (stream)
+			_mm_stream_ps((float *)&out[i], o);
+		else
+			out[i] = o;
+	}
+	if (stream)
+		_mm_sfence();
+}
+
+/* Component r of four transformed points, with e holding the elements of the matrix. */
+static cm_v4 cm_soa_row_sse_(cm_v4 const e[16], int r, cm_v4 x, cm_v4 y, cm_v4 z, cm_v4 w) {
+	return cm_madd_v4(e[12 + r], w, cm_madd_v4(e[8 + r], z, cm_madd_v4(e[4 + r], y, _mm_mul_ps(e[r], x))));
+}
+
+static void cm_store_sse_(cm_f1 *out, cm_v4 v, int stream) {
+	if (stream)
+		_mm_stream_ps(out, v);
+	else
+		_mm_storeu_ps(out, v);
+}
+
+/* Four points at a time, one per lane, without any shuffling. */
+static void cm_apply_soa_sse_(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n, int project) {
+	cm_f1 mf[16];
+	cm_recv_m16(m, mf);
+	size_t head = cm_soa_head_(out, 16), i = 0;
+	int stream = n * sizeof(cm_f1) * (out[3] != NULL ? 4 : 3) >= CM_STREAM_BYTES && head != SIZE_MAX;
+	if (stream) {
+		i = head < n ? head : n;
+		cm_apply_soa_scalar_(mf, in, out, 0, i, project);
+	}
+	cm_v4 e[16];
+	for (int k = 0; k < 16; k++)
+		e[k] = _mm_set1_ps(mf[k]);
+	cm_f1 const *inX = in[0], *inY = in[1], *inZ = in[2], *inW = in[3];
+	cm_f1 *outX = out[0], *outY = out[1], *outZ = out[2], *outW = out[3];
+	for (; i + 4 <= n; i += 4) {
+		cm_v4 x = _mm_loadu_ps(&inX[i]), y = _mm_loadu_ps(&inY[i]), z = _mm_loadu_ps(&inZ[i]);
+		cm_v4 w = inW != NULL ? _mm_loadu_ps(&inW[i]) : _mm_set1_ps(1.0f);
+		cm_v4 ox = cm_soa_row_sse_(e, 0, x, y, z, w), oy = cm_soa_row_sse_(e, 1, x, y, z, w);
+		cm_v4 oz = cm_soa_row_sse_(e, 2, x, y, z, w), ow = cm_soa_row_sse_(e, 3, x, y, z, w);
+		if (project) {
+			ow = _mm_div_ps(_mm_set1_ps(1.0f), ow);
+			ox = _mm_mul_ps(ox, ow), oy = _mm_mul_ps(oy, ow), oz = _mm_mul_ps(oz, ow);
+		}
+		cm_store_sse_(&outX[i], ox, stream);
+		cm_store_sse_(&outY[i], oy, stream);
+		cm_store_sse_(&outZ[i], oz, stream);
+		if (outW != NULL)
+			cm_store_sse_(&outW[i], ow, stream);
+	}
+	if (stream)
+		_mm_sfence();
+	cm_apply_soa_scalar_(mf, in, out, i, n, project);
+}
+
+static cm_v4 cm_column_sse_(cm_v4 l0, cm_v4 l1, cm_v4 l2, cm_v4 l3, cm_v4 rc) {
+	return cm_madd_v4(l3, cm_spread_v4(rc, 3), cm_madd_v4(l2, cm_spread_v4(rc, 2),
+		cm_madd_v4(l1, cm_spread_v4(rc, 1), _mm_mul_ps(l0, cm_spread_v4(rc, 0)))));
+}
+
+/* Everything is loaded before anything is stored, so out may alias the inputs. */
+static void cm_dot_sse_(cm_m16 const *l, size_t const *index, cm_m16 const *r, cm_m16 *out, size_t n, int stream) {
+	for (size_t i = 0; i < n; i++) {
+		cm_m16 const *a = &l[index != NULL ? index[i] : i];
+		cm_v4 l0 = a->c[0], l1 = a->c[1], l2 = a->c[2], l3 = a->c[3];
+		cm_v4 o0 = cm_column_sse_(l0, l1, l2, l3, r[i].c[0]);
+		cm_v4 o1 = cm_column_sse_(l0, l1, l2, l3, r[i].c[1]);
+		cm_v4 o2 = cm_column_sse_(l0, l1, l2, l3, r[i].c[2]);
+		cm_v4 o3 = cm_column_sse_(l0, l1, l2, l3, r[i].c[3]);
+		cm_store_sse_((cm_f1 *)&out[i].c[0], o0, stream);
+		cm_store_sse_((cm_f1 *)&out[i].c[1], o1, stream);
+		cm_store_sse_((cm_f1 *)&out[i].c[2], o2, stream);
+		cm_store_sse_((cm_f1 *)&out[i].c[3], o3, stream);
+	}
+	if (stream)
+		_mm_sfence();
+}
+
+#endif
+
+#if CM_AVX2_KERNELS_
+
+/* Two points at a time, one in each half of the registers. */
+CM_AVX2_TARGET_ static void cm_apply_aos_avx2_(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n, int project) {
+	size_t i = 0;
+	int stream = n * sizeof(cm_v4) >= CM_STREAM_BYTES;
+	if (stream && (uintptr_t)out % 32 != 0 && n > 0) {
+		cm_apply_aos_scalar_(m, in, out, 0, 1, project);
+		i = 1;
+	}
+	__m256 c0 = _mm256_broadcast_ps(&m.c[0]), c1 = _mm256_broadcast_ps(&m.c[1]);
+	__m256 c2 = _mm256_broadcast_ps(&m.c[2]), c3 = _mm256_broadcast_ps(&m.c[3]);
+	for (; i + 2 <= n; i += 2) {
+		__m256 p = _mm256_loadu_ps((float const *)&in[i]);
+		__m256 o = _mm256_mul_ps(c0, _mm256_permute_ps(p, 0x00));
+		o = _mm256_fmadd_ps(c1, _mm256_permute_ps(p, 0x55), o);
+		o = _mm256_fmadd_ps(c2, _mm256_permute_ps(p, 0xAA), o);
+		o = _mm256_fmadd_ps(c3, _mm256_permute_ps(p, 0xFF), o);
+		if (project) {
+			__m256 rw = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_permute_ps(o, 0xFF));
+			o = _mm256_blend_ps(_mm256_mul_ps(o, rw), rw, 0x88);
+		}
+		if (stream)
+			_mm256_stream_ps((float *)&out[i], o);
+		else
+			_mm256_storeu_ps((float *)&out[i], o);
+	}
+	if (stream)
+		_mm_sfence();
+	cm_apply_aos_scalar_(m, in, out, i, n, project);
+}
+
+CM_AVX2_TARGET_ static __m256 cm_soa_row_avx2_(__m256 const e[16], int r, __m256 x, __m256 y, __m256 z, __m256 w) {
+	return _mm256_fmadd_ps(e[12 + r], w, _mm256_fmadd_ps(e[8 + r], z, _mm256_fmadd_ps(e[4 + r], y, _mm256_mul_ps(e[r], x))));
+}
+
+CM_AVX2_TARGET_ static void cm_store_avx2_(cm_f1 *out, __m256 v, int stream) {
+	if (stream)
+		_mm256_stream_ps(out, v);
+	else
+		_mm256_storeu_ps(out, v);
+}
+
+/* Eight points at a time. */
+CM_AVX2_TARGET_ static void cm_apply_soa_avx2_(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n, int project) {
+	cm_f1 mf[16];
+	cm_recv_m16(m, mf);
+	size_t head = cm_soa_head_(out, 32), i = 0;
+	int stream = n * sizeof(cm_f1) * (out[3] != NULL ? 4 : 3) >= CM_STREAM_BYTES && head != SIZE_MAX;
+	if (stream) {
+		i = head < n ? head : n;
+		cm_apply_soa_scalar_(mf, in, out, 0, i, project);
+	}
+	__m256 e[16];
+	for (int k = 0; k < 16; k++)
+		e[k] = _mm256_set1_ps(mf[k]);
+	cm_f1 const *inX = in[0], *inY = in[1], *inZ = in[2], *inW = in[3];
+	cm_f1 *outX = out[0], *outY = out[1], *outZ = out[2], *outW = out[3];
+	for (; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_loadu_ps(&inX[i]), y = _mm256_loadu_ps(&inY[i]), z = _mm256_loadu_ps(&inZ[i]);
+		__m256 w = inW != NULL ? _mm256_loadu_ps(&inW[i]) : _mm256_set1_ps(1.0f);
+		__m256 ox = cm_soa_row_avx2_(e, 0, x, y, z, w), oy = cm_soa_row_avx2_(e, 1, x, y, z, w);
+		__m256 oz = cm_soa_row_avx2_(e, 2, x, y, z, w), ow = cm_soa_row_avx2_(e, 3, x, y, z, w);
+		if (project) {
+			ow = _mm256_div_ps(_mm256_set1_ps(1.0f), ow);
+			ox = _mm256_mul_ps(ox, ow), oy = _mm256_mul_ps(oy, ow), oz = _mm256_mul_ps(oz, ow);
+		}
+		cm_store_avx2_(&outX[i], ox, stream);
+		cm_store_avx2_(&outY[i], oy, stream);
+		cm_store_avx2_(&outZ[i], oz, stream);
+		if (outW != NULL)
+			cm_store_avx2_(&outW[i], ow, stream);
+	}
+	if (stream)
+		_mm_sfence();
+	cm_apply_soa_scalar_(mf, in, out, i, n, project);
+}
+
+/* Two columns of l * r at once, from rc holding two columns of r. */
+CM_AVX2_TARGET_ static __m256 cm_columns_avx2_(__m256 l0, __m256 l1, __m256 l2, __m256 l3, __m256 rc) {
+	return _mm256_fmadd_ps(l3, _mm256_permute_ps(rc, 0xFF), _mm256_fmadd_ps(l2, _mm256_permute_ps(rc, 0xAA),
+		_mm256_fmadd_ps(l1, _mm256_permute_ps(rc, 0x55), _mm256_mul_ps(l0, _mm256_permute_ps(rc, 0x00)))));
+}
+
+/* Matrices are only aligned to 16 bytes, which is enough for streaming each half. */
+CM_AVX2_TARGET_ static void cm_store_columns_avx2_(cm_v4 *out, __m256 v, int stream) {
+	if (!stream) {
+		_mm256_storeu_ps((cm_f1 *)out, v);
+	} else if ((uintptr_t)out % 32 == 0) {
+		_mm256_stream_ps((cm_f1 *)out, v);
+	} else {
+		_mm_stream_ps((cm_f1 *)&out[0], _mm256_castps256_ps128(v));
+		_mm_stream_ps((cm_f1 *)&out[1], _mm256_extractf128_ps(v, 1));
+	}
+}
+
+CM_AVX2_TARGET_ static void cm_dot_avx2_(cm_m16 const *l, size_t const *index, cm_m16 const *r, cm_m16 *out, size_t n, int stream) {
+	for (size_t i = 0; i < n; i++) {
+		cm_m16 const *a = &l[index != NULL ? index[i] : i];
+		__m256 l0 = _mm256_broadcast_ps(&a->c[0]), l1 = _mm256_broadcast_ps(&a->c[1]);
+		__m256 l2 = _mm256_broadcast_ps(&a->c[2]), l3 = _mm256_broadcast_ps(&a->c[3]);
+		__m256 o01 = cm_columns_avx2_(l0, l1, l2, l3, _mm256_loadu_ps((cm_f1 const *)&r[i].c[0]));
+		__m256 o23 = cm_columns_avx2_(l0, l1, l2, l3, _mm256_loadu_ps((cm_f1 const *)&r[i].c[2]));
+		cm_store_columns_avx2_(&out[i].c[0], o01, stream);
+		cm_store_columns_avx2_(&out[i].c[2], o23, stream);
+	}
+	if (stream)
+		_mm_sfence();
+}
+
+#endif
+
+static void cm_apply_aos_(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n, int project) {
+#if CM_AVX2_KERNELS_
+	if (cm_batch_backend() == CM_BACKEND_AVX2) {
+		cm_apply_aos_avx2_(m, in, out, n, project);
+		return;
+	}
+#endif
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+	cm_apply_aos_sse_(m, in, out, n, project);
+#else
+	cm_apply_aos_scalar_(m, in, out, 0, n, project);
+#endif
+}
+
+static void cm_apply_soa_(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n, int project) {
+#if CM_AVX2_KERNELS_
+	if (cm_batch_backend() == CM_BACKEND_AVX2) {
+		cm_apply_soa_avx2_(m, in, out, n, project);
+		return;
+	}
+#endif
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+	cm_apply_soa_sse_(m, in, out, n, project);
+#else
+	cm_f1 mf[16];
+	cm_recv_m16(m, mf);
+	cm_apply_soa_scalar_(mf, in, out, 0, n, project);
+#endif
+}
+
+void cm_apply_m16_batch(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n) {
+	cm_apply_aos_(m, in, out, n, 0);
+}
+
+void cm_project_m16_batch(cm_m16 m, cm_v4 const *in, cm_v4 *out, size_t n) {
+	cm_apply_aos_(m, in, out, n, 1);
+}
+
+void cm_apply_m16_soa(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n) {
+	cm_apply_soa_(m, in, out, n, 0);
+}
+
+void cm_project_m16_soa(cm_m16 m, cm_f1 const *const in[4], cm_f1 *const out[4], size_t n) {
+	cm_apply_soa_(m, in, out, n, 1);
+}
+
+void cm_aos_to_soa(cm_v4 const *in, cm_f1 *const out[4], size_t n) {
+	size_t i = 0;
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+	size_t head = cm_soa_head_(out, 16);
+	int stream = n * sizeof(cm_v4) >= CM_STREAM_BYTES && head != SIZE_MAX;
+	if (stream) {
+		for (; i < head && i < n; i++) {
+			cm_f1 c[4];
+			cm_recv_v4(in[i], c);
+			for (int r = 0; r < 4; r++) {
+				if (out[r] != NULL)
+					out[r][i] = c[r];
+			}
+		}
+	}
+	for (; i + 4 <= n; i += 4) {
+		cm_v4 o[4] = {in[i], in[i + 1], in[i + 2], in[i + 3]};
+		_MM_TRANSPOSE4_PS(o[0], o[1], o[2], o[3]);
+		for (int r = 0; r < 4; r++) {
+			if (out[r] == NULL)
+				continue;
+			if (stream)
+				_mm_stream_ps(&out[r][i], o[r]);
+			else
+				_mm_storeu_ps(&out[r][i], o[r]);
+		}
+	}
+	if (stream)
+		_mm_sfence();
+#endif
+	for (; i < n; i++) {
+		cm_f1 c[4];
+		cm_recv_v4(in[i], c);
+		for (int r = 0; r < 4; r++) {
+			if (out[r] != NULL)
+				out[r][i] = c[r];
+		}
+	}
+}
+
+void cm_soa_to_aos(cm_f1 const *const in[4], cm_v4 *out, size_t n) {
+	size_t i = 0;
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+	int stream = n * sizeof(cm_v4) >= CM_STREAM_BYTES;
+	for (; i + 4 <= n; i += 4) {
+		cm_v4 o[4] = {_mm_loadu_ps(&in[0][i]), _mm_loadu_ps(&in[1][i]), _mm_loadu_ps(&in[2][i]),
+			in[3] != NULL ? _mm_loadu_ps(&in[3][i]) : _mm_set1_ps(1.0f)};
+		_MM_TRANSPOSE4_PS(o[0], o[1], o[2], o[3]);
+		for (int k = 0; k < 4; k++) {
+			if (stream)
+				_mm_stream_ps((float *)&out[i + k], o[k]);
+			else
+				out[i + k] = o[k];
+		}
+	}
+	if (stream)
+		_mm_sfence();
+#endif
+	for (; i < n; i++)
+		out[i] = cm_new_v4(in[0][i], in[1][i], in[2][i], in[3] != NULL ? in[3][i] : 1.0f);
+}
+
+static int cm_batch_threads_ = 1;
+
+void cm_set_batch_threads(int threads) {
+	cm_batch_threads_ = threads < 1 ? 1 : threads > CM_MAX_THREADS ? CM_MAX_THREADS : threads;
+}
+
+/* out[i] = l[index[i]] * r[i], or l[i] * r[i] without an index, for i in [0, n). */
+struct cm_dot_job_ {
+	cm_m16 const *l;
+	size_t const *index;
+	cm_m16 const *r;
+	cm_m16 *out;
+	size_t n;
+	int backend;
+	int stream;
+};
+
+static void cm_dot_run_(struct cm_dot_job_ const *job) {
+#if CM_AVX2_KERNELS_
+	if (job->backend == CM_BACKEND_AVX2) {
+		cm_dot_avx2_(job->l, job->index, job->r, job->out, job->n, job->stream);
+		return;
+	}
+#endif
+#if CM_BACKEND == CM_BACKEND_SSE || CM_BACKEND == CM_BACKEND_AVX2
+	cm_dot_sse_(job->l, job->index, job->r, job->out, job->n, job->stream);
+#else
+	for (size_t i = 0; i < job->n; i++)
+		job->out[i] = cm_dot_m16(job->l[job->index != NULL ? job->index[i] : i], job->r[i]);
+#endif
+}
+
+#if CM_OPTION_PARALLEL
+static void *cm_dot_main_(void *arg) {
+	cm_dot_run_(arg);
+	return NULL;
+}
+#endif
+
+/* Whether out overlaps the part of mats that index refers to, so that some
+ * of the products read what others write. Only the addresses are compared. */
+static int cm_dot_chained_(cm_m16 const *mats, size_t const *index, cm_m16 const *out, size_t n) {
+	uintptr_t m = (uintptr_t)mats, o = (uintptr_t)out;
+	if (n == 0 || m >= o + n * sizeof(cm_m16))
+		return 0;
+	size_t top = 0;
+	for (size_t i = 0; i < n; i++)
+		top = index[i] > top ? index[i] : top;
+	return o < m + (top + 1) * sizeof(cm_m16);
+}
+
+static void cm_dot_batch_(cm_m16 const *l, size_t const *index, cm_m16 const *r, cm_m16 *out, size_t n) {
+	/* With the outputs feeding back in as parents, they have to stay in cache and in order. */
+	int chained = index != NULL && cm_dot_chained_(l, index, out, n);
+	struct cm_dot_job_ job = {l, index, r, out, n, cm_batch_backend(),
+		n * sizeof(cm_m16) >= CM_STREAM_BYTES && !chained};
+#if CM_OPTION_PARALLEL
+	int threads = cm_batch_threads_;
+	if (threads > 1 && n >= CM_PARALLEL_MIN && !chained) {
+		struct cm_dot_job_ jobs[CM_MAX_THREADS];
+		pthread_t ids[CM_MAX_THREADS];
+		int started[CM_MAX_THREADS];
+		for (int t = 0; t < threads; t++) {
+			size_t from = n * t / threads, to = n * (t + 1) / threads;
+			jobs[t] = job;
+			jobs[t].n = to - from;
+			jobs[t].r += from, jobs[t].out += from;
+			if (index != NULL)
+				jobs[t].index += from;
+			else
+				jobs[t].l += from;
+		}
+		for (int t = 1; t < threads; t++)
+			started[t] = pthread_create(&ids[t], NULL, cm_dot_main_, &jobs[t]) == 0;
+		cm_dot_run_(&jobs[0]);
+		for (int t = 1; t < threads; t++) {
+			if (started[t])
+				pthread_join(ids[t], NULL);
+			else
+				cm_dot_run_(&jobs[t]);
+		}
+		return;
+	}
+#endif
+	cm_dot_run_(&job);
+}
+
+void cm_dot_m16_batch(cm_m16 const *l, cm_m16 const *r, cm_m16 *out, size_t n) {
+	cm_dot_batch_(l, NULL, r, out, n);
+}
+
+void cm_dot_m16_indexed(cm_m16 const *mats, size_t const *parent, cm_m16 const *local, cm_m16 *out, size_t n) {
+	cm_dot_batch_(mats, parent, local, out, n);
+}
+
 #endif
 
@@ -33,37 +33,651 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* HT_OPTION_WIDE lifts the limits on key lengths and hash bits, for tables
+ * with billions of entries or keys longer than 32K. Slots grow from 16 to 24 bytes. */
+#if HT_OPTION_WIDE
+	typedef size_t HT_len;
+	typedef uint64_t HT_hash;
+#else
+	typedef short HT_len;
+	typedef uint32_t HT_hash;
+#endif
+
+/* Keys up to this many bytes long are stored directly in their slot by HT_OWN_KEYS tables.
+ * By default that's only the room the key pointer takes up anyway, since
+ * a bigger HT_INLINE_KEY makes the slots of every table bigger. */
+#ifndef HT_INLINE_KEY
+#	define HT_INLINE_KEY ((int)sizeof(char const *))
+#endif
+
 struct HT_key
 {
-	char const *name;
-	short length;
-	uint32_t hash;
+	/* Tables with HT_OWN_KEYS store short keys in bytes,
+	 * and longer ones at offset within their key arena. */
+	union {
+		char const *name;
+		size_t offset;
+		char bytes[HT_INLINE_KEY];
+	};
+#if HT_OPTION_WIDE
+	HT_hash hash;
+	__extension__ uint64_t length : 48;
+	__extension__ uint64_t dist : 16;
+#else
+	HT_len length;
+	uint16_t dist;
+	HT_hash hash;
+#endif
+};
+
+/* Resize incrementally: instead of rehashing everything at once, the old arrays
+ * stay alive and every following operation migrates a bounded number of slots. */
+#define HT_INCREMENTAL 0x1
+/* Seed the hash function with random bits instead of HT_params.seed,
+ * so that colliding keys can't be precomputed by an attacker. */
+#define HT_RANDOM_SEED 0x2
+/* Copy keys into the table instead of referencing the caller's memory, which therefore
+ * doesn't have to stay alive anymore. Short keys are stored inline, longer ones are
+ * appended to an arena that gets compacted whenever the table is resized, or once
+ * deleted keys take up more of it than live ones. */
+#define HT_OWN_KEYS 0x4
+/* Set on tables opened by htOpenMapped, which live in a read-only mapping of their file. */
+#define HT_MAPPED 0x8
+/* Keep values in separately allocated chunks that never move, with slots only holding
+ * their index. Pointers to a value then stay valid until its key is deleted,
+ * and resizing only has to move the indices instead of whole values. */
+#define HT_STABLE_VALUES 0x10
+/* Keep a Bloom filter next to the table, which answers most lookups of absent keys
+ * from a single cache line without touching the slots. Costs a byte per slot. */
+#define HT_FILTER 0x20
+
+typedef HT_hash (*HT_hash_fn)(void const *data, HT_len length, uint64_t seed);
+
+/* Where a table gets its memory from. alloc has to return zeroed memory like calloc,
+ * and all three get passed ctx, plus the size of the block they operate on.
+ * The only exceptions are the scratch arrays of htBuildFrom and parallel rebuilds,
+ * which are freed again before they return, and the HTC struct itself, which needs
+ * a stricter alignment than allocators provide. */
+struct HT_allocator
+{
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t oldSize, size_t size);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+};
+
+/* Plain calloc, realloc and free. */
+extern struct HT_allocator const htDefaultAllocator;
+#if defined(__linux__)
+/* Backs big blocks with 2 MB huge pages, so that lookups in large tables cause fewer
+ * TLB misses. Reserved huge pages are used if there are any, transparent ones otherwise. */
+extern struct HT_allocator const htHugePageAllocator;
+#endif
+
+struct HT_params
+{
+	unsigned flags;
+	/* NULL selects htHashWy. */
+	HT_hash_fn hash;
+	uint64_t seed;
+	/* NULL selects htDefaultAllocator. Has to outlive the table. */
+	struct HT_allocator const *allocator;
+	/* With HT_OPTION_PARALLEL, how many threads htBuildFrom and the rebuilds of big
+	 * tables may use. Rounded down to a power of two, and ignored otherwise. */
+	int threads;
+};
+
+#if HT_OPTION_STATS
+/* Displacements and probe lengths past the last bucket all go into that one. */
+#define HT_STATS_BUCKETS 32
+
+/* Running counts kept by tables built with HT_OPTION_STATS, see htStats. */
+struct HT_counters
+{
+	size_t lookups;
+	size_t compares;
+	size_t rebuilds;
+	size_t shrinks;
+	/* Lookups by the number of control byte groups they scanned. */
+	size_t probes[HT_STATS_BUCKETS];
+};
+#endif
+
+/* Where tables with HT_STABLE_VALUES keep their values. Value i lives in chunk
+ * i / HT_SLAB_CHUNK, and indices of deleted values are reused first. */
+struct HT_slab
+{
+	char **chunks;
+	size_t chunkCap;
+	size_t used;
+	size_t *free;
+	size_t freeCount;
+	size_t freeCap;
 };
 
 struct HT
 {
 	size_t cap;
 	int eSize;
-	int fill;
+	/* The size of what each slot holds in values: eSize, or an index with HT_STABLE_VALUES. */
+	int slotSize;
+	size_t fill;
+	unsigned flags;
+	HT_hash_fn hash;
+	uint64_t seed;
+	struct HT_allocator const *allocator;
+	int threads;
 	struct HT_key *keys;
+	unsigned char *ctrl;
 	char *values;
+	char *arena;
+	size_t arenaFill;
+	size_t arenaCap;
+	/* The bytes of arenaFill that belong to deleted keys. */
+	size_t arenaDead;
+	/* Shared with old during a migration. */
+	struct HT_slab *slab;
+	/* Keys deleted since the filter was last rebuilt, which it still reports. */
+	uint32_t *filter;
+	size_t filterStale;
+	/* While an incremental resize is in progress, the table being migrated
+	 * from, and the number of its slots that have been migrated so far. */
+	struct HT *old;
+	size_t migrated;
+#if HT_OPTION_STATS
+	struct HT_counters counters;
+#endif
 };
 
 struct HT htNew(size_t cap, int eSize);
+struct HT htNewWith(size_t cap, int eSize, struct HT_params const *params);
+/* Creates a table holding the n keys in names, with the values stored one after another
+ * in values, or zeroed if that is NULL. This sizes the table once and fills it in a
+ * single pass, split over params->threads. Keys should be distinct; of duplicates,
+ * only one is kept, with any one of their values. */
+struct HT htBuildFrom(void const *const *names, HT_len const *lengths, void const *values,
+	size_t n, int eSize, struct HT_params const *params);
 void htFree(struct HT *ht);
-void htSet(struct HT *ht, void const *name, short length, void *value);
-void htDel(struct HT *ht, void const *name, short length);
-bool htHas(struct HT *ht, void const *name, short length);
-void *htGet(struct HT *ht, void const *name, short length);
+void htSet(struct HT *ht, void const *name, HT_len length, void *value);
+void htDel(struct HT *ht, void const *name, HT_len length);
+bool htHas(struct HT *ht, void const *name, HT_len length);
+void *htGet(struct HT *ht, void const *name, HT_len length);
+/* Returns the value stored under name, inserting a zeroed one first if there is none.
+ * Unlike htGet followed by htSet, this only probes the table once. */
+void *htGetOrInsert(struct HT *ht, void const *name, HT_len length, bool *inserted);
+/* Looks up n keys at once, storing what htGet would have returned for each in out.
+ * The memory accesses of neighbouring lookups are overlapped, which makes this
+ * several times faster than a loop over htGet on tables that don't fit into cache. */
+void htGetBatch(struct HT *ht, void const *const *names, HT_len const *lengths, size_t n, void **out);
+
+/* Variants of the above that take the hash of the key from the caller instead of
+ * computing it. The hash has to be the same every time for the same key, and if the
+ * table is also used through the plain functions, it has to match the table's hash function. */
+void htSetHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash, void *value);
+void htDelHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash);
+bool htHasHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash);
+void *htGetHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash);
+void *htGetOrInsertHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash, bool *inserted);
+
+/* Built-in hash functions. htHashWy is fast on keys of any length and the default,
+ * htHashOneAtATime is the slower byte-at-a-time hash used by earlier versions. */
+HT_hash htHashWy(void const *data, HT_len length, uint64_t seed);
+HT_hash htHashOneAtATime(void const *data, HT_len length, uint64_t seed);
+
+#if HT_OPTION_STATS
+
+struct HT_stats
+{
+	/* Live entries by their distance from their home slot. */
+	size_t displacement[HT_STATS_BUCKETS];
+	/* Lookups and insertions since creation by the number of control byte groups
+	 * they went through, including the ones that missed. Lookups that the
+	 * HT_FILTER filter turned away go into the first bucket. Insertions read
+	 * the control bytes one by one, and count each HT_GROUP of them as a group. */
+	size_t probeLength[HT_STATS_BUCKETS];
+	size_t maxDisplacement;
+	/* Key comparisons, i.e. fingerprint matches, per lookup or insertion since creation. */
+	double comparesPerLookup;
+	/* How often the table was rebuilt, and how many of those were shrinks. */
+	size_t rebuilds;
+	size_t shrinks;
+	/* Deletions shift entries back instead of leaving tombstones, so the only
+	 * ones are the slots of the old table already migrated during a resize. */
+	double tombstoneDensity;
+	size_t bytesAllocated;
+};
+
+/* Walks the whole table, so it takes time proportional to its capacity.
+ * The running counts behind it are only a few increments per operation, which are
+ * not synchronized. That is enough for plain tables, which are only ever used from one
+ * thread at a time, but it means the shards of an HTC count for themselves, under their
+ * locks, and that htcGet, which takes none, is not counted at all. */
+void htStats(struct HT *ht, struct HT_stats *stats);
+
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define HT_HAVE_MMAP 1
+#endif
+
+/* htSave writes the table to a file that htOpenMapped maps back into memory, serving
+ * lookups straight from the mapping without reading or rebuilding anything. Keys are
+ * stored inline or as offsets into the file, so it can be mapped at any address and
+ * shared between processes through the page cache. The table has to be opened with
+ * the same hash function and HT_OPTION_WIDE setting it was saved with. Mapped tables
+ * are read-only: only lookups and htFree may be used on them. Both return false on failure.
+ * htOpenMapped checks that the layout of the file is consistent with its size, but not
+ * the keys themselves, so snapshots have to come from a trusted source. */
+bool htSave(struct HT *ht, char const *path);
+#if HT_HAVE_MMAP
+/* NULL selects htHashWy. */
+bool htOpenMapped(struct HT *ht, char const *path, HT_hash_fn hash);
+#endif
+
+/* A read-only copy of a table, built around a minimal perfect hash function: every key
+ * maps to its own slot out of exactly fill ones, so a lookup only ever looks at a single
+ * slot. Each group of HTF_BUCKET_SIZE keys on average shares a bucket, and each bucket
+ * has a pilot that was searched for so that its keys land on slots nobody else took.
+ * Key bytes are packed back to back in slot order, with the values in a dense array. */
+struct HTF
+{
+	size_t fill;
+	int eSize;
+	uint64_t seed;
+	size_t buckets;
+	uint32_t *pilots;
+	/* Pilots pick slots out of a slightly bigger range than fill, which keeps them
+	 * easy to find even for the last few keys. Keys that land past fill are sent
+	 * on to the free slot remap[slot - fill] instead. */
+	size_t range;
+	size_t *remap;
+	/* Key i spans arena[offsets[i]] up to arena[offsets[i + 1]]. */
+	size_t *offsets;
+	char *arena;
+	char *values;
+	struct HT_allocator const *allocator;
+};
+
+/* Copies the contents of ht, which stays usable and has to be freed separately.
+ * The keys are copied as well, regardless of HT_OWN_KEYS. */
+struct HTF htFreeze(struct HT *ht);
+void htfFree(struct HTF *htf);
+bool htfHas(struct HTF *htf, void const *name, HT_len length);
+void *htfGet(struct HTF *htf, void const *name, HT_len length);
+
+/* A table that stays within a maximum number of entries, or of key and value bytes,
+ * by evicting entries that haven't been used recently. Eviction follows the CLOCK
+ * algorithm: a hand sweeps over the slots, clearing the reference bit of entries that
+ * were looked up since it last passed and evicting the first one that wasn't. The bit
+ * is kept right after each value, so evicting never needs to look anything up.
+ * Values get padded to their alignment to make room for it. */
+struct HT_cache
+{
+	struct HT ht;
+	int eSize;
+	/* Either limit may be zero for none. */
+	size_t maxEntries;
+	size_t maxBytes;
+	/* The lengths of all keys plus eSize for each entry, which maxBytes limits. */
+	size_t bytes;
+	size_t hand;
+};
+
+/* HT_INCREMENTAL is ignored. Keys have to outlive their entries, so with borrowed keys
+ * that aren't static anyway, HT_OWN_KEYS is usually what you want. */
+struct HT_cache htCacheNew(size_t maxEntries, size_t maxBytes, int eSize, struct HT_params const *params);
+void htCacheFree(struct HT_cache *cache);
+/* Returns NULL if name isn't cached. */
+void *htCacheGet(struct HT_cache *cache, void const *name, HT_len length);
+/* Stores a copy of value under name, evicting other entries as needed, and returns
+ * where it was stored. Entries bigger than maxBytes by themselves return NULL instead. */
+void *htCachePut(struct HT_cache *cache, void const *name, HT_len length, void const *value);
+void htCacheDel(struct HT_cache *cache, void const *name, HT_len length);
+
+/* A table that keeps its entries in a dense array in insertion order, and only small
+ * indices into it in the hash slots: one byte each up to 256 slots, then two, four
+ * or eight. The slots are ordered as in a Robin Hood table, with each entry's distance
+ * from home recomputed from its hash. Deleted entries leave a hole behind, which the
+ * next rebuild squeezes out; rebuilds otherwise only have to redo the indices.
+ * base holds the settings, and the entries in base.keys and base.values, of which
+ * base.fill are in use including the holes. Only HT_OWN_KEYS and HT_RANDOM_SEED apply. */
+struct HTO
+{
+	struct HT base;
+	size_t live;
+	size_t cap;
+	int width;
+	void *index;
+};
+
+struct HTO htoNew(size_t cap, int eSize, struct HT_params const *params);
+void htoFree(struct HTO *hto);
+void htoSet(struct HTO *hto, void const *name, HT_len length, void *value);
+void htoDel(struct HTO *hto, void const *name, HT_len length);
+bool htoHas(struct HTO *hto, void const *name, HT_len length);
+void *htoGet(struct HTO *hto, void const *name, HT_len length);
+/* Steps through the entries in the order they were inserted, starting from a cursor
+ * of zero, and returns false at the end. The current entry may be deleted while
+ * iterating, but inserting anything may cause entries to be skipped. */
+bool htoNext(struct HTO *hto, size_t *cursor, void const **name, HT_len *length, void **value);
+
+/* ~~~~ TYPED TABLES ~~~~ */
+
+/* HT_DECLARE(name, KeyT, ValT, hashfn, eqfn) generates a Robin Hood table specialized
+ * for keys of type KeyT and values of type ValT, both of which are stored inline.
+ * Since all sizes are known at compile time, there are no variable-length copies or
+ * memcmp()s involved. hashfn(key) has to return a uint32_t, and eqfn(a, b) may also be
+ * a function-like macro. The generated functions are:
+ *
+ *   struct name name##New(size_t cap);
+ *   void name##Free(struct name *t);
+ *   void name##Set(struct name *t, KeyT key, ValT value);
+ *   void name##Del(struct name *t, KeyT key);
+ *   bool name##Has(struct name *t, KeyT key);
+ *   ValT *name##Get(struct name *t, KeyT key);
+ *
+ * Every slot has a separate probe distance, which is zero for empty
+ * slots and one more than the entry's distance from its home slot otherwise.
+ * It saturates at UINT16_MAX, past which it is recomputed from the key. */
+
+#include <stdlib.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#	define HT_UNUSED __attribute__((unused))
+#else
+#	define HT_UNUSED
+#endif
+
+/* Ready-made hashfn and eqfn for integer keys. */
+static inline uint32_t htHashU64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return (uint32_t)x;
+}
+#define htEqScalar(a, b) ((a) == (b))
+
+#define HT_DECLARE(name, KeyT, ValT, hashfn, eqfn) \
+	struct name##_slot { KeyT key; ValT value; }; \
+	struct name { size_t cap; size_t fill; uint16_t *dist; struct name##_slot *slots; }; \
+	\
+	HT_UNUSED static struct name name##New(size_t cap) \
+	{ \
+		size_t pow2 = 1; \
+		while (pow2 < cap) \
+			pow2 <<= 1; \
+		struct name t = {pow2, 0, calloc(pow2, sizeof(uint16_t)), malloc(pow2 * sizeof(struct name##_slot))}; \
+		return t; \
+	} \
+	\
+	HT_UNUSED static void name##Free(struct name *t) \
+	{ \
+		free(t->dist); \
+		free(t->slots); \
+	} \
+	\
+	HT_UNUSED static size_t name##Dist_(struct name *t, size_t slot) \
+	{ \
+		if (t->dist[slot] < UINT16_MAX) \
+			return t->dist[slot]; \
+		return ((slot - hashfn(t->slots[slot].key)) & (t->cap - 1)) + 1; \
+	} \
+	\
+	HT_UNUSED static void name##SetDist_(struct name *t, size_t slot, size_t dist) \
+	{ \
+		t->dist[slot] = dist < UINT16_MAX ? dist : UINT16_MAX; \
+	} \
+	\
+	HT_UNUSED static void name##Insert_(struct name *t, struct name##_slot entry, size_t dist, size_t slot) \
+	{ \
+		for (;; slot = (slot + 1) & (t->cap - 1), ++dist) { \
+			if (t->dist[slot] == 0) { \
+				t->slots[slot] = entry; \
+				name##SetDist_(t, slot, dist); \
+				return; \
+			} \
+			size_t d = name##Dist_(t, slot); \
+			if (d < dist) { \
+				struct name##_slot e = t->slots[slot]; \
+				t->slots[slot] = entry; \
+				name##SetDist_(t, slot, dist); \
+				entry = e, dist = d; \
+			} \
+		} \
+	} \
+	\
+	HT_UNUSED static void name##Resize_(struct name *t, size_t cap) \
+	{ \
+		struct name new = name##New(cap); \
+		new.fill = t->fill; \
+		for (size_t i = 0; i < t->cap; ++i) { \
+			if (t->dist[i] != 0) \
+				name##Insert_(&new, t->slots[i], 1, hashfn(t->slots[i].key) & (new.cap - 1)); \
+		} \
+		name##Free(t); \
+		*t = new; \
+	} \
+	\
+	/* Returns the slot holding key, or -1. An entry with a different distance */ \
+	/* than the key would have at the same slot can't be the key itself. */ \
+	HT_UNUSED static ptrdiff_t name##Find_(struct name *t, KeyT key) \
+	{ \
+		size_t slot = hashfn(key) & (t->cap - 1), d; \
+		for (size_t dist = 1; (d = name##Dist_(t, slot)) >= dist; ++dist) { \
+			if (d == dist && eqfn(t->slots[slot].key, key)) \
+				return slot; \
+			slot = (slot + 1) & (t->cap - 1); \
+		} \
+		return -1; \
+	} \
+	\
+	HT_UNUSED static void name##Set(struct name *t, KeyT key, ValT value) \
+	{ \
+		if ((double)(t->fill + 1) / (double)t->cap > 0.8) \
+			name##Resize_(t, t->cap * 2); \
+		size_t slot = hashfn(key) & (t->cap - 1), dist = 1, d; \
+		for (; (d = name##Dist_(t, slot)) >= dist; ++dist) { \
+			if (d == dist && eqfn(t->slots[slot].key, key)) { \
+				t->slots[slot].value = value; \
+				return; \
+			} \
+			slot = (slot + 1) & (t->cap - 1); \
+		} \
+		++t->fill; \
+		name##Insert_(t, (struct name##_slot){key, value}, dist, slot); \
+	} \
+	\
+	HT_UNUSED static void name##Del(struct name *t, KeyT key) \
+	{ \
+		ptrdiff_t found = name##Find_(t, key); \
+		if (found < 0) \
+			return; \
+		size_t slot = found, next = (slot + 1) & (t->cap - 1), d; \
+		while ((d = name##Dist_(t, next)) > 1) { \
+			t->slots[slot] = t->slots[next]; \
+			name##SetDist_(t, slot, d - 1); \
+			slot = next; \
+			next = (next + 1) & (t->cap - 1); \
+		} \
+		t->dist[slot] = 0; \
+		--t->fill; \
+		if ((double)t->fill / (double)t->cap < 0.2) \
+			name##Resize_(t, t->cap / 2); \
+	} \
+	\
+	HT_UNUSED static bool name##Has(struct name *t, KeyT key) \
+	{ \
+		return name##Find_(t, key) >= 0; \
+	} \
+	\
+	HT_UNUSED static ValT *name##Get(struct name *t, KeyT key) \
+	{ \
+		ptrdiff_t slot = name##Find_(t, key); \
+		return slot >= 0 ? &t->slots[slot].value : NULL; \
+	}
+
+#if HT_OPTION_CONCURRENT
+
+/* A thread-safe variant, made of HTC_SHARDS separate tables that keys get
+ * distributed over by their hash. Writers lock the shard they modify, and readers
+ * don't lock at all: Every shard has a sequence number that writers increment before
+ * and after modifying it, and readers simply retry whenever it has changed under them.
+ * When a shard is resized, its old table is only freed after all readers that could still
+ * see it are done. Since values might change at any time, they are always copied out.
+ * Keys are always referenced, never owned by the table. */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define HTC_SHARD_BITS	6
+#define HTC_SHARDS	(1 << HTC_SHARD_BITS)
+#define HTC_READER_SLOTS	64
+
+struct HTC_shard
+{
+	_Alignas(64) pthread_mutex_t lock;
+	atomic_uint seq;
+	_Atomic(struct HT *) table;
+};
+
+/* Readers announce themselves in one of these, by the parity of the epoch they started in. */
+struct HTC_readers
+{
+	_Alignas(64) atomic_uint count[2];
+};
+
+struct HTC
+{
+	int eSize;
+	HT_hash_fn hash;
+	uint64_t seed;
+	atomic_uint epoch;
+	pthread_mutex_t epochLock;
+	struct HTC_shard shards[HTC_SHARDS];
+	struct HTC_readers readers[HTC_READER_SLOTS];
+};
+
+struct HTC *htcNew(size_t cap, int eSize, struct HT_params const *params);
+void htcFree(struct HTC *htc);
+void htcSet(struct HTC *htc, void const *name, HT_len length, void *value);
+void htcDel(struct HTC *htc, void const *name, HT_len length);
+bool htcHas(struct HTC *htc, void const *name, HT_len length);
+/* Copies the value stored under name to out, if there is one. */
+bool htcGet(struct HTC *htc, void const *name, HT_len length, void *out);
+/* Waits until every read that is in progress right now has finished. Since readers
+ * may still be comparing against a key after it has been deleted, the memory of
+ * deleted keys may only be released after calling this. */
+void htcSynchronize(struct HTC *htc);
+
+#endif
 
 #endif
 
 #ifdef HT_IMPLEMENT_HERE
 
+/* Each slot has a control byte stored apart from the keys: either a 7-bit
+ * fingerprint of the hash of the resident key, or HT_CTRL_EMPTY.
+ * Lookups compare a whole group of control bytes at once and only touch
+ * the keys whose fingerprint matches. */
+#define HT_SIMD_NONE	0
+#define HT_SIMD_SSE2	1
+#define HT_SIMD_AVX2	2
+
+/* If the user didn't supply a HT_OPTION_SIMD, then choose automatically. */
+#ifndef HT_OPTION_SIMD
+#	if defined(__AVX2__)
+#		define HT_OPTION_SIMD HT_SIMD_AVX2
+#	elif defined(__SSE2__) || _M_IX86_FP >= 2 || defined(_M_X64)
+#		define HT_OPTION_SIMD HT_SIMD_SSE2
+#	else
+#		define HT_OPTION_SIMD HT_SIMD_NONE
+#	endif
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
+#if HT_OPTION_SIMD == HT_SIMD_AVX2
+#	include <immintrin.h>
+#	define HT_GROUP 32
+#elif HT_OPTION_SIMD == HT_SIMD_SSE2
+#	include <emmintrin.h>
+#	define HT_GROUP 16
+#else
+#	define HT_GROUP 8
+#endif
+
+#define HT_CTRL_EMPTY	0x80
+/* Only found in tables that are being migrated away from. Marks
+ * entries that are gone, but still have to be probed past. */
+#define HT_CTRL_MOVED	0xFE
+
+/* How many slots of the old table every operation migrates during an incremental resize.
+ * Small enough to bound latency, but big enough that a migration is always finished
+ * long before the new table could need resizing itself. */
+#define HT_MIGRATE_STEP	32
+
+/* How many slots share a 32 byte block of the filter. */
+#define HT_FILTER_SLOTS	32
+
+/* Tables smaller than this are always rebuilt on a single thread. */
+#define HT_PARALLEL_MIN	65536
+
+/* How many values each chunk of a HT_STABLE_VALUES table holds. */
+#define HT_SLAB_CHUNK	256
+
+/* Distances from the home slot saturate at this in HT_key.dist. */
+#define HT_DIST_MAX	0xFFFF
+
+#if HT_OPTION_STATS
+#	define HT_COUNT(ht, counter) (++(ht)->counters.counter)
+#	define HT_COUNT_PROBE(ht, groups) \
+		(++(ht)->counters.probes[(groups) < HT_STATS_BUCKETS ? (groups) : HT_STATS_BUCKETS - 1])
+#else
+#	define HT_COUNT(ht, counter) ((void)0)
+#	define HT_COUNT_PROBE(ht, groups) ((void)0)
+#endif
+
+/* How many lookups htGetBatch keeps in flight at once. */
+#define HT_BATCH	16
+
+#if defined(__GNUC__) || defined(__clang__)
+#	define HT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#	define HT_PREFETCH(addr) ((void)(addr))
+#endif
+
+/* Index of the lowest set bit in mask, which mustn't be zero. */
+#if defined(__GNUC__) || defined(__clang__)
+#	define HT_CTZ(mask) __builtin_ctz(mask)
+#elif defined(_MSC_VER)
+#	include <intrin.h>
+static int lowest_bit(uint32_t mask)
+{
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+}
+#	define HT_CTZ(mask) lowest_bit(mask)
+#else
+static int lowest_bit(uint32_t mask)
+{
+	int index = 0;
+	for (; !(mask & 1); mask >>= 1)
+		++index;
+	return index;
+}
+#	define HT_CTZ(mask) lowest_bit(mask)
+#endif
+
 static double const load_factor = 0.8;
+/* Shrinking halves the capacity, so the table has to fall well below
+ * load_factor / 2 first. Otherwise a mix of insertions and deletions
+ * near the boundary would keep rebuilding the table back and forth. */
+static double const shrink_factor = 0.2;
 
 static void memswap(void *a, void *b, size_t size)
 {
@@ -73,11 +687,10 @@ static void memswap(void *a, void *b, size_t size)
 	memcpy(b, t, size);
 }
 
-static uint32_t hash_func(char const *data, short length)
+static uint32_t one_at_a_time(char const *bytes, HT_len length, uint32_t hash)
 {
-	uint32_t hash = 33;
-	for (short i = 0; i < length; ++i) {
-		hash += data[i];
+	for (HT_len i = 0; i < length; ++i) {
+		hash += bytes[i];
 		hash += hash << 10;
 		hash ^= hash >> 6;
 	}
@@ -87,126 +700,2204 @@ static uint32_t hash_func(char const *data, short length)
 	return hash;
 }
 
-struct search_result { bool found; int slot; };
+HT_hash htHashOneAtATime(void const *data, HT_len length, uint64_t seed)
+{
+	uint32_t hash = one_at_a_time(data, length, 33 ^ (uint32_t)seed ^ (uint32_t)(seed >> 32));
+#if HT_OPTION_WIDE
+	/* One round only has 32 bits, so a second, differently seeded one provides the rest. */
+	return (uint64_t)one_at_a_time(data, length, ~hash) << 32 | hash;
+#else
+	return hash;
+#endif
+}
 
-static int fold_slot(struct HT *ht, uint32_t slot)
-{ return slot % ht->cap; }
+/* Word-at-a-time hash, based on wyhash (final version 4) by Wang Yi,
+ * which has been released into the public domain. */
 
-static int distance(struct HT *ht, struct HT_key key, int slot)
-{ int d = slot - fold_slot(ht, key.hash); if (d < 0) { d += ht->cap; } return d; }
+static uint64_t const wy_secret[4] = {
+	0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+	0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
 
-static int advance(struct HT *ht, int slot)
-{ return fold_slot(ht, slot + 1); }
+static void wy_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+	__extension__ unsigned __int128 r = (unsigned __int128)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wy_mix(uint64_t a, uint64_t b)
+{ wy_mum(&a, &b); return a ^ b; }
+
+static uint64_t wy_r8(unsigned char const *p)
+{ uint64_t v; memcpy(&v, p, 8); return v; }
+
+static uint64_t wy_r4(unsigned char const *p)
+{ uint32_t v; memcpy(&v, p, 4); return v; }
+
+static uint64_t wy_r3(unsigned char const *p, size_t k)
+{ return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1]; }
+
+static uint64_t wy_hash(void const *data, size_t len, uint64_t seed)
+{
+	unsigned char const *p = data;
+	uint64_t a, b;
+	seed ^= wy_mix(seed ^ wy_secret[0], wy_secret[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+			b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = wy_r3(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wy_mix(wy_r8(p)      ^ wy_secret[1], wy_r8(p +  8) ^ seed);
+				see1 = wy_mix(wy_r8(p + 16) ^ wy_secret[2], wy_r8(p + 24) ^ see1);
+				see2 = wy_mix(wy_r8(p + 32) ^ wy_secret[3], wy_r8(p + 40) ^ see2);
+				p += 48, i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ seed);
+			p += 16, i -= 16;
+		}
+		a = wy_r8(p + i - 16);
+		b = wy_r8(p + i - 8);
+	}
+	a ^= wy_secret[1];
+	b ^= seed;
+	wy_mum(&a, &b);
+	return wy_mix(a ^ wy_secret[0] ^ len, b ^ wy_secret[1]);
+}
 
-static bool does_match(struct HT_key a, struct HT_key b)
-{ return a.hash == b.hash && a.length == b.length && memcmp(a.name, b.name, a.length) == 0; }
+HT_hash htHashWy(void const *data, HT_len length, uint64_t seed)
+{
+	uint64_t hash = wy_hash(data, length, seed);
+#if HT_OPTION_WIDE
+	return hash;
+#else
+	return (uint32_t)(hash ^ (hash >> 32));
+#endif
+}
 
-static void mark_tombstone(struct HT_key *key)
-{ key->name = NULL; }
+#if defined(__linux__)
+#	include <sys/random.h>
+#endif
+#include <time.h>
 
-static bool is_tombstone(struct HT_key key)
-{ return key.name == NULL; }
+static uint64_t random_seed(void)
+{
+	uint64_t seed = 0;
+#if defined(__linux__)
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) == sizeof(seed))
+		return seed;
+#endif
+	/* No system entropy source, so mix whatever varies between calls and runs. */
+	static uint64_t counter;
+	seed = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32) ^ (uintptr_t)&seed ^ ++counter;
+	return wy_mix(seed ^ wy_secret[2], wy_secret[3]);
+}
 
-static struct HT_key make_key(char const *name, short length)
-{ return (struct HT_key){name, length, hash_func(name, length)}; }
+static void *default_alloc(void *ctx, size_t size)
+{
+	(void)ctx;
+	return calloc(1, size);
+}
 
-static char *value_at(struct HT *ht, int slot)
-{ return &ht->values[slot * ht->eSize]; }
+static void *default_realloc(void *ctx, void *ptr, size_t oldSize, size_t size)
+{
+	(void)ctx, (void)oldSize;
+	return realloc(ptr, size);
+}
 
-static int evict(struct HT *ht, struct HT_key key, int slot)
+static void default_free(void *ctx, void *ptr, size_t size)
 {
-	return distance(ht, key, slot) > distance(ht, ht->keys[slot], slot) ? slot
-		: evict(ht, key, advance(ht, slot));
+	(void)ctx, (void)size;
+	free(ptr);
 }
 
-static void insert_at(struct HT *ht, struct HT_key key, void *value, int slot)
+struct HT_allocator const htDefaultAllocator = {default_alloc, default_realloc, default_free, NULL};
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+
+/* Smaller blocks aren't worth a mapping of their own and come from calloc. */
+#define HT_HUGE_PAGE	((size_t)2 << 20)
+
+static size_t huge_round(size_t size)
+{ return (size + HT_HUGE_PAGE - 1) & ~(HT_HUGE_PAGE - 1); }
+
+static void *huge_alloc(void *ctx, size_t size)
 {
-	memswap(&ht->keys[slot], &key, sizeof(key));
-	memswap(value_at(ht, slot), value, ht->eSize);
-	if (!is_tombstone(key))
-		insert_at(ht, key, value, evict(ht, key, advance(ht, slot)));
+	(void)ctx;
+	if (size < HT_HUGE_PAGE)
+		return calloc(1, size);
+	size = huge_round(size);
+	char *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr != MAP_FAILED)
+		return ptr;
+#endif
+	/* No huge pages reserved, so ask for transparent ones instead. Those only
+	 * cover aligned 2 MB ranges, so map a bit more and trim it to alignment. */
+	ptr = mmap(NULL, size + HT_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+	size_t head = huge_round((uintptr_t)ptr) - (uintptr_t)ptr;
+	if (head > 0)
+		munmap(ptr, head);
+	munmap(ptr + head + size, HT_HUGE_PAGE - head);
+	ptr += head;
+#ifdef MADV_HUGEPAGE
+	madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	return ptr;
 }
 
-static struct search_result locate_at(struct HT *ht, struct HT_key key, int slot)
+static void huge_free(void *ctx, void *ptr, size_t size)
 {
-	if (does_match(ht->keys[slot], key))
-		return (struct search_result){true, slot};
-	else if (distance(ht, key, slot) > distance(ht, ht->keys[slot], slot))
-		return (struct search_result){false, slot};
+	(void)ctx;
+	if (size < HT_HUGE_PAGE)
+		free(ptr);
 	else
-		return locate_at(ht, key, advance(ht, slot));
+		munmap(ptr, huge_round(size));
 }
 
-static struct search_result locate(struct HT *ht, struct HT_key key)
-{ return locate_at(ht, key, fold_slot(ht, key.hash)); }
+static void *huge_realloc(void *ctx, void *ptr, size_t oldSize, size_t size)
+{
+	if (oldSize < HT_HUGE_PAGE && size < HT_HUGE_PAGE)
+		return realloc(ptr, size);
+	if (oldSize >= HT_HUGE_PAGE && size >= HT_HUGE_PAGE && huge_round(oldSize) == huge_round(size))
+		return ptr;
+	/* Like realloc, a failure leaves the old block alone. */
+	void *new = huge_alloc(ctx, size);
+	if (new == NULL)
+		return NULL;
+	if (oldSize > 0)
+		memcpy(new, ptr, oldSize < size ? oldSize : size);
+	huge_free(ctx, ptr, oldSize);
+	return new;
+}
 
-static void rebuild(struct HT *ht, size_t cap)
+struct HT_allocator const htHugePageAllocator = {huge_alloc, huge_realloc, huge_free, NULL};
+
+#endif
+
+/* Returns a bit mask of all control bytes in the group starting at ctrl that equal c. */
+#if HT_OPTION_SIMD == HT_SIMD_AVX2
+static uint32_t group_match(unsigned char const *ctrl, unsigned char c)
 {
-	struct HT new = htNew(cap, ht->eSize);
-	new.fill = ht->fill;
-	for (size_t i = 0; i < ht->cap; ++i) {
-		struct HT_key key = ht->keys[i];
-		if (!is_tombstone(key)) {
-			int slot = evict(&new, key, fold_slot(&new, key.hash));
-			insert_at(&new, key, value_at(ht, i), slot);
+	__m256i group = _mm256_loadu_si256((__m256i const *)ctrl);
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(c)));
+}
+#elif HT_OPTION_SIMD == HT_SIMD_SSE2
+static uint32_t group_match(unsigned char const *ctrl, unsigned char c)
+{
+	__m128i group = _mm_loadu_si128((__m128i const *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+}
+#else
+static uint32_t group_match(unsigned char const *ctrl, unsigned char c)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < HT_GROUP; ++i)
+		mask |= (uint32_t)(ctrl[i] == c) << i;
+	return mask;
+}
+#endif
+
+struct search_result { bool found; size_t slot; };
+
+/* Capacities are always powers of two, so wrapping around is a simple mask. */
+static size_t fold_slot(struct HT *ht, size_t slot)
+{ return slot & (ht->cap - 1); }
+
+static size_t advance(struct HT *ht, size_t slot)
+{ return fold_slot(ht, slot + 1); }
+
+static char const *key_name(struct HT *ht, struct HT_key const *key)
+{
+	if (!(ht->flags & HT_OWN_KEYS))
+		return key->name;
+	return key->length <= HT_INLINE_KEY ? key->bytes : ht->arena + key->offset;
+}
+
+/* The key being searched for always references the caller's memory. */
+static bool keys_equal(struct HT *ht, struct HT_key const *resident, struct HT_key const *key)
+{
+	return resident->hash == key->hash && resident->length == key->length
+		&& memcmp(key_name(ht, resident), key->name, key->length) == 0;
+}
+
+static bool does_match(struct HT *ht, struct HT_key const *resident, struct HT_key const *key)
+{
+	HT_COUNT(ht, compares);
+	return keys_equal(ht, resident, key);
+}
+
+/* All of a table's memory goes through these. */
+static void *allocate(struct HT_allocator const *a, size_t size)
+{ return (a->alloc)(a->ctx, size); }
+
+static void *reallocate(struct HT_allocator const *a, void *ptr, size_t oldSize, size_t size)
+{ return (a->realloc)(a->ctx, ptr, oldSize, size); }
+
+static void deallocate(struct HT_allocator const *a, void *ptr, size_t size)
+{ (a->free)(a->ctx, ptr, size); }
+
+/* Makes the table store a copy of the key bytes at name, instead of referencing them. */
+static void own_key(struct HT *ht, struct HT_key *key, char const *name)
+{
+	if (key->length <= HT_INLINE_KEY) {
+		memcpy(key->bytes, name, key->length);
+		return;
+	}
+	if (ht->arenaFill + key->length > ht->arenaCap) {
+		size_t cap = 2 * ht->arenaCap + key->length;
+		ht->arena = reallocate(ht->allocator, ht->arena, ht->arenaCap, cap);
+		ht->arenaCap = cap;
+	}
+	memcpy(ht->arena + ht->arenaFill, name, key->length);
+	key->offset = ht->arenaFill;
+	ht->arenaFill += key->length;
+}
+
+static HT_hash hash_of(struct HT *ht, char const *name, HT_len length)
+{ return ht->hash(name, length, ht->seed); }
+
+static struct HT_key make_key(char const *name, HT_len length, HT_hash hash)
+{ return (struct HT_key){.name = name, .length = length, .hash = hash}; }
+
+/* What the slot holds: the value itself, or its index with HT_STABLE_VALUES. */
+static char *value_at(struct HT *ht, size_t slot)
+{ return &ht->values[slot * ht->slotSize]; }
+
+static char *slab_value(struct HT *ht, size_t index)
+{ return ht->slab->chunks[index / HT_SLAB_CHUNK] + index % HT_SLAB_CHUNK * ht->eSize; }
+
+static char *value_of(struct HT *ht, size_t slot)
+{
+	if (!(ht->flags & HT_STABLE_VALUES))
+		return value_at(ht, slot);
+	size_t index;
+	memcpy(&index, value_at(ht, slot), sizeof(index));
+	return slab_value(ht, index);
+}
+
+/* Returns the index of a zeroed value that isn't used by any other entry. */
+static size_t slab_acquire(struct HT *ht)
+{
+	struct HT_slab *slab = ht->slab;
+	size_t index;
+	if (slab->freeCount > 0) {
+		index = slab->free[--slab->freeCount];
+		memset(slab_value(ht, index), 0, ht->eSize);
+		return index;
+	}
+	index = slab->used++;
+	size_t chunk = index / HT_SLAB_CHUNK;
+	if (index % HT_SLAB_CHUNK == 0) {
+		if (chunk == slab->chunkCap) {
+			size_t cap = 2 * slab->chunkCap + 1;
+			slab->chunks = reallocate(ht->allocator, slab->chunks,
+				slab->chunkCap * sizeof(*slab->chunks), cap * sizeof(*slab->chunks));
+			slab->chunkCap = cap;
 		}
+		slab->chunks[chunk] = allocate(ht->allocator, HT_SLAB_CHUNK * ht->eSize);
 	}
-	htFree(ht);
-	memcpy(ht, &new, sizeof(new));
+	return index;
 }
 
-struct HT htNew(size_t cap, int eSize)
+static void slab_release(struct HT *ht, char const *record)
 {
-	struct HT ht = {cap, eSize, 0, NULL, NULL};
-	ht.keys = calloc(cap, sizeof(*ht.keys));
-	ht.values = calloc(cap, eSize);
-	for (unsigned int i = 0; i < cap; ++i)
-		ht.keys[i].hash = i;
-	return ht;
+	struct HT_slab *slab = ht->slab;
+	if (slab->freeCount == slab->freeCap) {
+		size_t cap = 2 * slab->freeCap + 16;
+		slab->free = reallocate(ht->allocator, slab->free,
+			slab->freeCap * sizeof(*slab->free), cap * sizeof(*slab->free));
+		slab->freeCap = cap;
+	}
+	memcpy(&slab->free[slab->freeCount++], record, sizeof(size_t));
 }
 
-void htFree(struct HT *ht)
+static void slab_free(struct HT *ht)
 {
-	free(ht->keys);
-	free(ht->values);
+	struct HT_slab *slab = ht->slab;
+	for (size_t c = 0; c * HT_SLAB_CHUNK < slab->used; ++c)
+		deallocate(ht->allocator, slab->chunks[c], HT_SLAB_CHUNK * ht->eSize);
+	deallocate(ht->allocator, slab->chunks, slab->chunkCap * sizeof(*slab->chunks));
+	deallocate(ht->allocator, slab->free, slab->freeCap * sizeof(*slab->free));
+	deallocate(ht->allocator, slab, sizeof(*slab));
 }
 
-void htSet(struct HT *ht, void const *name, short length, void *value)
+static unsigned char fingerprint(HT_hash hash)
+{ return hash >> (8 * sizeof(hash) - 7); }
+
+static bool is_empty(struct HT *ht, size_t slot)
+{ return ht->ctrl[slot] == HT_CTRL_EMPTY; }
+
+static bool is_live(struct HT *ht, size_t slot)
+{ return !(ht->ctrl[slot] & 0x80); }
+
+/* The control bytes of the first HT_GROUP - 1 slots are mirrored past the end
+ * of the array, so that a group load never has to wrap around. */
+static void set_ctrl(struct HT *ht, size_t slot, unsigned char c)
 {
-	if ((double)(ht->fill + 1) / (double)ht->cap > load_factor)
-		rebuild(ht, ht->cap * 2);
-	struct HT_key key = make_key(name, length);
-	struct search_result search = locate(ht, key);
-	if (search.found) {
-		memcpy(value_at(ht, search.slot), value, ht->eSize);
-	} else {
-		++ht->fill;
-		char buf[ht->eSize];
-		memcpy(buf, value, ht->eSize);
-		insert_at(ht, key, buf, search.slot);
+	ht->ctrl[slot] = c;
+	for (size_t i = slot + ht->cap; i < ht->cap + HT_GROUP - 1; i += ht->cap)
+		ht->ctrl[i] = c;
+}
+
+/* The filter is a split block Bloom filter: each key picks a block of eight 32-bit words
+ * with the bottom bits of its remixed hash, and sets one bit in each of them, chosen by
+ * multiplying the top half with a different odd constant per word. */
+static uint32_t const filter_salts[8] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+static size_t filter_blocks(size_t cap)
+{ return cap > HT_FILTER_SLOTS ? cap / HT_FILTER_SLOTS : 1; }
+
+static uint32_t *filter_block(struct HT *ht, HT_hash hash, uint32_t *bits)
+{
+	uint64_t h = wy_mix(hash, wy_secret[2]);
+	*bits = h >> 32;
+	return &ht->filter[(h & (filter_blocks(ht->cap) - 1)) * 8];
+}
+
+static void filter_add(struct HT *ht, HT_hash hash)
+{
+	uint32_t bits, *block = filter_block(ht, hash, &bits);
+	for (int i = 0; i < 8; ++i)
+		block[i] |= 1u << (bits * filter_salts[i] >> 27);
+}
+
+#if HT_OPTION_SIMD == HT_SIMD_AVX2
+static bool filter_has(struct HT *ht, HT_hash hash)
+{
+	uint32_t bits, *block = filter_block(ht, hash, &bits);
+	__m256i salts = _mm256_loadu_si256((__m256i const *)filter_salts);
+	__m256i shifts = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(bits), salts), 27);
+	__m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+	return _mm256_testc_si256(_mm256_loadu_si256((__m256i const *)block), mask);
+}
+#else
+static bool filter_has(struct HT *ht, HT_hash hash)
+{
+	uint32_t bits, *block = filter_block(ht, hash, &bits);
+	for (int i = 0; i < 8; ++i) {
+		if (!(block[i] & 1u << (bits * filter_salts[i] >> 27)))
+			return false;
 	}
+	return true;
 }
+#endif
 
-void htDel(struct HT *ht, void const *name, short length)
+static void filter_build(struct HT *ht)
 {
-	struct search_result search = locate(ht, make_key(name, length));
-	if (search.found) {
-		mark_tombstone(&ht->keys[search.slot]);
-		--ht->fill;
-		if ((double)ht->fill / (double)ht->cap < 0.5 * load_factor)
-			rebuild(ht, ht->cap / 2);
+	memset(ht->filter, 0, filter_blocks(ht->cap) * 8 * sizeof(*ht->filter));
+	for (size_t i = 0; i < ht->cap; ++i) {
+		if (is_live(ht, i))
+			filter_add(ht, ht->keys[i].hash);
+	}
+	ht->filterStale = 0;
+}
+
+/* Deleted keys can't be taken out of the filter again, so once
+ * they make up half of it, it gets rebuilt from the live ones. */
+static void filter_forget(struct HT *ht)
+{
+	if ((ht->flags & HT_FILTER) && ++ht->filterStale > ht->fill)
+		filter_build(ht);
+}
+
+/* Every entry carries its distance from its home slot in key.dist, so that it doesn't
+ * have to be recomputed from the hash. That only fits up to HT_DIST_MAX though, which
+ * a degenerate hash function can exceed, so past that it is recomputed after all. */
+static size_t dist_from(struct HT *ht, struct HT_key const *key, size_t slot)
+{ return fold_slot(ht, slot - fold_slot(ht, key->hash)); }
+
+static size_t dist_at(struct HT *ht, size_t slot)
+{
+	size_t dist = ht->keys[slot].dist;
+	return dist < HT_DIST_MAX ? dist : dist_from(ht, &ht->keys[slot], slot);
+}
+
+static void set_dist(struct HT_key *key, size_t dist)
+{ key->dist = dist < HT_DIST_MAX ? dist : HT_DIST_MAX; }
+
+/* Finds the slot from which on key has to push the other entries away. */
+static size_t evict(struct HT *ht, struct HT_key const *key, size_t slot)
+{
+	for (size_t dist = dist_from(ht, key, slot); !is_empty(ht, slot) && dist <= dist_at(ht, slot); ++dist)
+		slot = advance(ht, slot);
+	return slot;
+}
+
+static void insert_at(struct HT *ht, struct HT_key key, void *value, size_t slot)
+{
+	if (ht->flags & HT_FILTER)
+		filter_add(ht, key.hash);
+	for (;;) {
+		bool was_empty = is_empty(ht, slot);
+		set_dist(&key, dist_from(ht, &key, slot));
+		memswap(&ht->keys[slot], &key, sizeof(key));
+		memswap(value_at(ht, slot), value, ht->slotSize);
+		set_ctrl(ht, slot, fingerprint(ht->keys[slot].hash));
+		if (was_empty)
+			return;
+		slot = evict(ht, &key, advance(ht, slot));
+	}
+}
+
+/* Backward-shift deletion: instead of leaving a tombstone behind, every
+ * following entry that isn't in its home slot moves one slot closer to it. */
+static void remove_at(struct HT *ht, size_t slot)
+{
+	if ((ht->flags & HT_OWN_KEYS) && ht->keys[slot].length > HT_INLINE_KEY)
+		ht->arenaDead += ht->keys[slot].length;
+	size_t next = advance(ht, slot), dist;
+	while (!is_empty(ht, next) && (dist = dist_at(ht, next)) > 0) {
+		ht->keys[slot] = ht->keys[next];
+		set_dist(&ht->keys[slot], dist - 1);
+		memcpy(value_at(ht, slot), value_at(ht, next), ht->slotSize);
+		set_ctrl(ht, slot, ht->ctrl[next]);
+		slot = next;
+		next = advance(ht, next);
+	}
+	set_ctrl(ht, slot, HT_CTRL_EMPTY);
+}
+
+/* Deleted keys leave their bytes behind in the arena, so it is rebuilt once they make up
+ * most of it. Requiring as many dead bytes as there are slots keeps the cost of that
+ * proportional to what it frees. */
+static bool arena_wasted(struct HT *ht)
+{
+	return ht->arenaDead > ht->arenaFill - ht->arenaDead && ht->arenaDead >= ht->cap;
+}
+
+/* Walks one slot at a time, and stops at the slot dist away from the home slot, after
+ * reading dist + 1 control bytes. For the statistics, every HT_GROUP of those count as
+ * one group, the same way find() counts the groups it loads starting at the home slot. */
+static struct search_result locate(struct HT *ht, struct HT_key const *key)
+{
+	HT_COUNT(ht, lookups);
+	size_t slot = fold_slot(ht, key->hash), dist = 0;
+	bool found = false;
+	for (;; ++dist, slot = advance(ht, slot)) {
+		if (is_empty(ht, slot) || dist > dist_at(ht, slot))
+			break;
+		if (ht->ctrl[slot] == fingerprint(key->hash) && does_match(ht, &ht->keys[slot], key)) {
+			found = true;
+			break;
+		}
+	}
+	HT_COUNT_PROBE(ht, (dist + HT_GROUP) / HT_GROUP);
+	return (struct search_result){found, slot};
+}
+
+/* Lookup-only counterpart to locate(). Since an entry never lies past an empty slot
+ * of its probe sequence, the search can stop at the first empty control byte. */
+static struct search_result find(struct HT *ht, struct HT_key key)
+{
+	HT_COUNT(ht, lookups);
+	if ((ht->flags & HT_FILTER) && !filter_has(ht, key.hash)) {
+		HT_COUNT_PROBE(ht, 0);
+		return (struct search_result){false, 0};
+	}
+	unsigned char fp = fingerprint(key.hash);
+	size_t pos = fold_slot(ht, key.hash), n = 0;
+	while (n < ht->cap) {
+		uint32_t match = group_match(&ht->ctrl[pos], fp);
+		uint32_t empty = group_match(&ht->ctrl[pos], HT_CTRL_EMPTY);
+		n += HT_GROUP;
+		if (empty)
+			match &= (empty & -empty) - 1;
+		while (match) {
+			size_t slot = fold_slot(ht, pos + HT_CTZ(match));
+			if (does_match(ht, &ht->keys[slot], &key)) {
+				HT_COUNT_PROBE(ht, n / HT_GROUP);
+				return (struct search_result){true, slot};
+			}
+			match &= match - 1;
+		}
+		if (empty)
+			break;
+		pos = fold_slot(ht, pos + HT_GROUP);
 	}
+	HT_COUNT_PROBE(ht, n / HT_GROUP);
+	return (struct search_result){false, 0};
 }
 
-bool htHas(struct HT *ht, void const *name, short length)
+static size_t round_capacity(size_t cap)
 {
-	return locate(ht, make_key(name, length)).found;
+	size_t pow2 = 1;
+	while (pow2 < cap)
+		pow2 <<= 1;
+	return pow2;
 }
 
-void *htGet(struct HT *ht, void const *name, short length)
+static void alloc_arrays(struct HT *ht, size_t cap)
 {
-	struct search_result search = locate(ht, make_key(name, length));
-	return search.found ? value_at(ht, search.slot) : NULL;
+	ht->cap = round_capacity(cap);
+	ht->keys = allocate(ht->allocator, ht->cap * sizeof(*ht->keys));
+	ht->ctrl = allocate(ht->allocator, ht->cap + HT_GROUP - 1);
+	ht->values = allocate(ht->allocator, ht->cap * ht->slotSize);
+	memset(ht->ctrl, HT_CTRL_EMPTY, ht->cap + HT_GROUP - 1);
+	if (ht->flags & HT_FILTER)
+		ht->filter = allocate(ht->allocator, filter_blocks(ht->cap) * 8 * sizeof(*ht->filter));
+	ht->filterStale = 0;
+	ht->arena = NULL;
+	ht->arenaFill = 0;
+	ht->arenaCap = 0;
+	ht->arenaDead = 0;
 }
 
+static void free_arrays(struct HT *ht)
+{
+	deallocate(ht->allocator, ht->keys, ht->cap * sizeof(*ht->keys));
+	deallocate(ht->allocator, ht->ctrl, ht->cap + HT_GROUP - 1);
+	deallocate(ht->allocator, ht->values, ht->cap * ht->slotSize);
+	deallocate(ht->allocator, ht->arena, ht->arenaCap);
+	if (ht->flags & HT_FILTER)
+		deallocate(ht->allocator, ht->filter, filter_blocks(ht->cap) * 8 * sizeof(*ht->filter));
+}
+
+/* Leaves src untouched, so that it can still be read from while this is going on.
+ * Every table has its own key arena, so only live keys get copied over. */
+static void migrate_entry(struct HT *ht, struct HT *src, size_t slot)
+{
+	struct HT_key key = src->keys[slot];
+	if (ht->flags & HT_OWN_KEYS)
+		own_key(ht, &key, key_name(src, &src->keys[slot]));
+	char buf[ht->slotSize];
+	memcpy(buf, value_at(src, slot), ht->slotSize);
+	size_t dest = evict(ht, &key, fold_slot(ht, key.hash));
+	insert_at(ht, key, buf, dest);
+}
+
+/* ~~~~ BULK LOADING ~~~~ */
+
+/* Builds a table in one go from a known set of entries, which are either the live slots
+ * of another table or the arrays passed to htBuildFrom. The slots are split into one
+ * region per thread, and the entries grouped by the region of their home slot with a
+ * radix pass. Each thread then runs ordinary Robin Hood insertions within its region.
+ * Whatever would have to be pushed past its end is set aside, and inserted by the
+ * calling thread at the end, along with any duplicate keys. */
+
+#if HT_OPTION_PARALLEL
+#	include <pthread.h>
+#endif
+
+struct bulk_spill
+{
+	char *records;
+	size_t count;
+	size_t cap;
+};
+
+struct bulk
+{
+	struct HT *ht;
+	/* The source is either old, whose n slots are scanned, or n entries of names,
+	 * lengths and values. NULL values are all zero. */
+	struct HT *old;
+	void const *const *names;
+	HT_len const *lengths;
+	char const *values;
+	size_t n;
+	int threads;
+	int shift;
+	HT_hash *hashes;
+	/* counts[t * threads + r] entries of chunk t of the source have their home in region r,
+	 * and are scattered into order starting at pos[t * threads + r]. */
+	size_t *counts;
+	size_t *pos;
+	size_t *order;
+	/* Where long keys of HT_OWN_KEYS tables start in the arena, by source entry. */
+	size_t *offsets;
+	size_t *arenaStarts;
+	struct bulk_spill *spills;
+};
+
+static bool bulk_live(struct bulk *b, size_t i)
+{ return b->old == NULL || is_live(b->old, i); }
+
+static char const *bulk_name(struct bulk *b, size_t i)
+{ return b->old != NULL ? key_name(b->old, &b->old->keys[i]) : b->names[i]; }
+
+static HT_len bulk_length(struct bulk *b, size_t i)
+{ return b->old != NULL ? (HT_len)b->old->keys[i].length : b->lengths[i]; }
+
+static bool bulk_long_key(struct bulk *b, size_t i)
+{ return (b->ht->flags & HT_OWN_KEYS) && bulk_length(b, i) > HT_INLINE_KEY; }
+
+static size_t bulk_chunk_start(struct bulk *b, int t)
+{ return b->n / b->threads * t + (t == b->threads ? b->n % b->threads : 0); }
+
+static size_t bulk_region(struct bulk *b, size_t i)
+{ return fold_slot(b->ht, b->hashes[i]) >> b->shift; }
+
+/* Hashes each entry and counts how many go into each region. */
+static void bulk_count(struct bulk *b, int t)
+{
+	size_t *counts = &b->counts[t * b->threads];
+	for (size_t i = bulk_chunk_start(b, t); i < bulk_chunk_start(b, t + 1); ++i) {
+		if (!bulk_live(b, i))
+			continue;
+		b->hashes[i] = b->old != NULL ? b->old->keys[i].hash
+			: hash_of(b->ht, b->names[i], b->lengths[i]);
+		++counts[bulk_region(b, i)];
+		if (bulk_long_key(b, i))
+			b->arenaStarts[t] += bulk_length(b, i);
+	}
+}
+
+/* Scatters the entries by region, and copies over everything that lives outside the slots. */
+static void bulk_scatter(struct bulk *b, int t)
+{
+	struct HT *ht = b->ht;
+	size_t *pos = &b->pos[t * b->threads], arenaFill = b->arenaStarts[t];
+	for (size_t i = bulk_chunk_start(b, t); i < bulk_chunk_start(b, t + 1); ++i) {
+		if (!bulk_live(b, i))
+			continue;
+		b->order[pos[bulk_region(b, i)]++] = i;
+		if (bulk_long_key(b, i)) {
+			b->offsets[i] = arenaFill;
+			memcpy(ht->arena + arenaFill, bulk_name(b, i), bulk_length(b, i));
+			arenaFill += bulk_length(b, i);
+		}
+		/* New entries of stable tables get the value at their own index. */
+		if (b->old == NULL && (ht->flags & HT_STABLE_VALUES) && b->values != NULL)
+			memcpy(slab_value(ht, i), b->values + i * ht->eSize, ht->eSize);
+	}
+}
+
+static void bulk_set_aside(struct bulk *b, int t, struct HT_key *key, void const *value)
+{
+	struct bulk_spill *spill = &b->spills[t];
+	size_t size = sizeof(*key) + b->ht->slotSize;
+	if (spill->count == spill->cap) {
+		spill->cap = 2 * spill->cap + 16;
+		spill->records = realloc(spill->records, spill->cap * size);
+	}
+	memcpy(spill->records + spill->count * size, key, sizeof(*key));
+	memcpy(spill->records + spill->count * size + sizeof(*key), value, b->ht->slotSize);
+	++spill->count;
+}
+
+/* Like locate followed by insert_at, except that it never goes past end.
+ * Owned keys are already in their final form, so name is compared against instead.
+ * This runs on several threads at once, so it leaves the counters alone. */
+static void bulk_insert(struct bulk *b, int t, struct HT_key key, char const *name, void *value, size_t end)
+{
+	struct HT *ht = b->ht;
+	struct HT_key probe = make_key(name, key.length, key.hash);
+	size_t slot = fold_slot(ht, key.hash), dist = 0;
+	for (;; ++slot, ++dist) {
+		if (slot == end) {
+			bulk_set_aside(b, t, &key, value);
+			return;
+		}
+		if (is_empty(ht, slot) || dist > dist_at(ht, slot))
+			break;
+		if (ht->ctrl[slot] == fingerprint(key.hash) && keys_equal(ht, &ht->keys[slot], &probe)) {
+			bulk_set_aside(b, t, &key, value);
+			return;
+		}
+	}
+	for (;;) {
+		bool was_empty = is_empty(ht, slot);
+		set_dist(&key, dist);
+		memswap(&ht->keys[slot], &key, sizeof(key));
+		memswap(value_at(ht, slot), value, ht->slotSize);
+		set_ctrl(ht, slot, fingerprint(ht->keys[slot].hash));
+		if (was_empty)
+			return;
+		dist = dist_from(ht, &key, slot);
+		for (++dist, ++slot; slot < end; ++dist, ++slot) {
+			if (is_empty(ht, slot) || dist > dist_at(ht, slot))
+				break;
+		}
+		if (slot == end) {
+			bulk_set_aside(b, t, &key, value);
+			return;
+		}
+	}
+}
+
+static void bulk_place(struct bulk *b, int t)
+{
+	struct HT *ht = b->ht;
+	size_t end = (size_t)(t + 1) << b->shift;
+	char buf[ht->slotSize];
+	for (size_t o = b->pos[t], oEnd = b->pos[b->threads * b->threads + t]; o < oEnd; ++o) {
+		size_t i = b->order[o];
+		char const *name = bulk_name(b, i);
+		struct HT_key key = make_key(name, bulk_length(b, i), b->hashes[i]);
+		if (bulk_long_key(b, i))
+			key.offset = b->offsets[i];
+		else if (ht->flags & HT_OWN_KEYS)
+			memcpy(key.bytes, name, key.length);
+		if (b->old != NULL)
+			memcpy(buf, value_at(b->old, i), ht->slotSize);
+		else if (ht->flags & HT_STABLE_VALUES)
+			memcpy(buf, &i, sizeof(i));
+		else if (b->values != NULL)
+			memcpy(buf, b->values + i * ht->eSize, ht->eSize);
+		else
+			memset(buf, 0, ht->eSize);
+		bulk_insert(b, t, key, name, buf, end);
+	}
+}
+
+#if HT_OPTION_PARALLEL
+
+struct bulk_job
+{
+	struct bulk *b;
+	void (*phase)(struct bulk *, int);
+	int t;
+};
+
+static void *bulk_job_main(void *arg)
+{
+	struct bulk_job *job = arg;
+	job->phase(job->b, job->t);
+	return NULL;
+}
+
+/* Threads that can't be started have their share done by the caller. */
+static void bulk_run(struct bulk *b, void (*phase)(struct bulk *, int))
+{
+	struct bulk_job jobs[b->threads];
+	pthread_t threads[b->threads];
+	bool started[b->threads];
+	for (int t = 1; t < b->threads; ++t) {
+		jobs[t] = (struct bulk_job){b, phase, t};
+		started[t] = pthread_create(&threads[t], NULL, bulk_job_main, &jobs[t]) == 0;
+	}
+	phase(b, 0);
+	for (int t = 1; t < b->threads; ++t) {
+		if (started[t])
+			pthread_join(threads[t], NULL);
+		else
+			phase(b, t);
+	}
+}
+
+#else
+
+static void bulk_run(struct bulk *b, void (*phase)(struct bulk *, int))
+{
+	for (int t = 0; t < b->threads; ++t)
+		phase(b, t);
+}
+
+#endif
+
+/* Fills ht, which has to be empty, and returns the number of entries that turned out to
+ * be duplicates. The source table stays untouched, but the values of a stable table
+ * must have been reserved at the indices of their entries already. */
+static size_t bulk_build(struct HT *ht, struct HT *old, void const *const *names,
+	HT_len const *lengths, void const *values, size_t n, int threads)
+{
+	struct bulk b = {.ht = ht, .old = old, .names = names, .lengths = lengths, .values = values, .n = n};
+	/* A power of two, so that regions are made of the top bits of the home slot. */
+	b.threads = 1;
+#if HT_OPTION_PARALLEL
+	while (b.threads * 2 <= threads && (size_t)b.threads * 2 <= ht->cap)
+		b.threads *= 2;
+#else
+	(void)threads;
+#endif
+	int bits = 0;
+	while ((size_t)1 << bits < ht->cap)
+		++bits;
+	for (int r = 1; r < b.threads; r *= 2)
+		--bits;
+	b.shift = bits;
+
+	size_t tt = (size_t)b.threads * b.threads;
+	b.hashes = malloc(n * sizeof(*b.hashes));
+	b.counts = calloc(tt, sizeof(*b.counts));
+	b.pos = malloc((tt + b.threads) * sizeof(*b.pos));
+	b.arenaStarts = calloc(b.threads, sizeof(*b.arenaStarts));
+	b.spills = calloc(b.threads, sizeof(*b.spills));
+	bulk_run(&b, bulk_count);
+
+	/* Entries are grouped by region first, and by the chunk they came from second.
+	 * The last row of pos is left pointing at where each region ends. */
+	size_t live = 0, arenaSize = 0;
+	for (int r = 0; r < b.threads; ++r) {
+		for (int t = 0; t < b.threads; ++t) {
+			b.pos[t * b.threads + r] = live;
+			live += b.counts[t * b.threads + r];
+		}
+		b.pos[tt + r] = live;
+	}
+	for (int t = 0; t < b.threads; ++t) {
+		size_t bytes = b.arenaStarts[t];
+		b.arenaStarts[t] = arenaSize;
+		arenaSize += bytes;
+	}
+	b.order = malloc(live * sizeof(*b.order));
+	b.offsets = ht->flags & HT_OWN_KEYS ? malloc(n * sizeof(*b.offsets)) : NULL;
+	if (arenaSize > 0) {
+		ht->arena = allocate(ht->allocator, arenaSize);
+		ht->arenaFill = ht->arenaCap = arenaSize;
+	}
+	bulk_run(&b, bulk_scatter);
+	/* After scattering, pos[r] is where region r begins, since chunk 0 comes first. */
+	for (int r = 0; r < b.threads; ++r)
+		b.pos[r] = r == 0 ? 0 : b.pos[tt + r - 1];
+	bulk_run(&b, bulk_place);
+	if (ht->flags & HT_FILTER)
+		filter_build(ht);
+
+	size_t duplicates = 0, size = sizeof(struct HT_key) + ht->slotSize;
+	for (int t = 0; t < b.threads; ++t) {
+		struct bulk_spill *spill = &b.spills[t];
+		for (size_t s = 0; s < spill->count; ++s) {
+			struct HT_key key;
+			memcpy(&key, spill->records + s * size, sizeof(key));
+			char *value = spill->records + s * size + sizeof(key);
+			struct HT_key probe = make_key(key_name(ht, &key), key.length, key.hash);
+			struct search_result search = locate(ht, &probe);
+			if (!search.found) {
+				insert_at(ht, key, value, search.slot);
+				continue;
+			}
+			++duplicates;
+			if (ht->flags & HT_STABLE_VALUES)
+				slab_release(ht, value);
+		}
+		free(spill->records);
+	}
+	free(b.hashes);
+	free(b.counts);
+	free(b.pos);
+	free(b.arenaStarts);
+	free(b.spills);
+	free(b.order);
+	free(b.offsets);
+	return duplicates;
+}
+
+static void rebuild(struct HT *ht, size_t cap)
+{
+	struct HT new = *ht;
+	alloc_arrays(&new, cap);
+#if HT_OPTION_PARALLEL
+	if (ht->threads > 1 && ht->fill >= HT_PARALLEL_MIN) {
+		bulk_build(&new, ht, NULL, NULL, NULL, ht->cap, ht->threads);
+		free_arrays(ht);
+		*ht = new;
+		return;
+	}
+#endif
+	for (size_t i = 0; i < ht->cap; ++i) {
+		if (is_live(ht, i))
+			migrate_entry(&new, ht, i);
+	}
+	free_arrays(ht);
+	*ht = new;
+}
+
+/* The old arrays stay where they are, so they can still be searched
+ * normally. Migrated entries only get their control byte overwritten. */
+static void start_migration(struct HT *ht, size_t cap)
+{
+	ht->old = allocate(ht->allocator, sizeof(*ht->old));
+	*ht->old = *ht;
+#if HT_OPTION_STATS
+	ht->old->counters = (struct HT_counters){0};
+#endif
+	alloc_arrays(ht, cap);
+	ht->migrated = 0;
+}
+
+/* Lookups in the old table during a migration are counted there first. */
+static void merge_counters(struct HT *ht, struct HT *old)
+{
+#if HT_OPTION_STATS
+	ht->counters.lookups += old->counters.lookups;
+	ht->counters.compares += old->counters.compares;
+	for (int b = 0; b < HT_STATS_BUCKETS; ++b)
+		ht->counters.probes[b] += old->counters.probes[b];
+#else
+	(void)ht, (void)old;
+#endif
+}
+
+static void migrate(struct HT *ht)
+{
+	struct HT *old = ht->old;
+	if (old == NULL)
+		return;
+	size_t end = ht->migrated + HT_MIGRATE_STEP;
+	if (end > old->cap)
+		end = old->cap;
+	for (size_t i = ht->migrated; i < end; ++i) {
+		if (is_live(old, i)) {
+			migrate_entry(ht, old, i);
+			set_ctrl(old, i, HT_CTRL_MOVED);
+		}
+	}
+	ht->migrated = end;
+	if (end == old->cap) {
+		merge_counters(ht, old);
+		free_arrays(old);
+		deallocate(ht->allocator, old, sizeof(*old));
+		ht->old = NULL;
+	}
+}
+
+/* While a migration is still running, resizing is simply put off until it is done. */
+static void resize(struct HT *ht, size_t cap)
+{
+	if ((ht->flags & HT_INCREMENTAL) && ht->old != NULL)
+		return;
+	HT_COUNT(ht, rebuilds);
+	if (cap < ht->cap)
+		HT_COUNT(ht, shrinks);
+	if (!(ht->flags & HT_INCREMENTAL))
+		rebuild(ht, cap);
+	else
+		start_migration(ht, cap);
+}
+
+struct HT htNew(size_t cap, int eSize)
+{
+	return htNewWith(cap, eSize, &(struct HT_params){0});
+}
+
+struct HT htNewWith(size_t cap, int eSize, struct HT_params const *params)
+{
+	struct HT ht = {.eSize = eSize, .flags = params->flags};
+	ht.hash = params->hash != NULL ? params->hash : htHashWy;
+	ht.seed = params->flags & HT_RANDOM_SEED ? random_seed() : params->seed;
+	ht.allocator = params->allocator != NULL ? params->allocator : &htDefaultAllocator;
+	ht.threads = params->threads;
+	ht.slotSize = eSize;
+	if (ht.flags & HT_STABLE_VALUES) {
+		ht.slotSize = sizeof(size_t);
+		ht.slab = allocate(ht.allocator, sizeof(*ht.slab));
+	}
+	alloc_arrays(&ht, cap);
+	return ht;
+}
+
+struct HT htBuildFrom(void const *const *names, HT_len const *lengths, void const *values,
+	size_t n, int eSize, struct HT_params const *params)
+{
+	struct HT ht = htNewWith(n / load_factor + 1, eSize, params);
+	if (ht.flags & HT_STABLE_VALUES) {
+		struct HT_slab *slab = ht.slab;
+		slab->chunkCap = (n + HT_SLAB_CHUNK - 1) / HT_SLAB_CHUNK;
+		slab->chunks = allocate(ht.allocator, slab->chunkCap * sizeof(*slab->chunks));
+		for (size_t c = 0; c < slab->chunkCap; ++c)
+			slab->chunks[c] = allocate(ht.allocator, HT_SLAB_CHUNK * eSize);
+		slab->used = n;
+	}
+	ht.fill = n - bulk_build(&ht, NULL, names, lengths, values, n, ht.threads);
+	return ht;
+}
+
+#if HT_HAVE_MMAP
+static void unmap_snapshot(struct HT *ht);
+#endif
+
+void htFree(struct HT *ht)
+{
+#if HT_HAVE_MMAP
+	if (ht->flags & HT_MAPPED) {
+		unmap_snapshot(ht);
+		return;
+	}
+#endif
+	if (ht->old != NULL) {
+		free_arrays(ht->old);
+		deallocate(ht->allocator, ht->old, sizeof(*ht->old));
+	}
+	if (ht->flags & HT_STABLE_VALUES)
+		slab_free(ht);
+	free_arrays(ht);
+}
+
+void htSet(struct HT *ht, void const *name, HT_len length, void *value)
+{
+	htSetHashed(ht, name, length, hash_of(ht, name, length), value);
+}
+
+void htDel(struct HT *ht, void const *name, HT_len length)
+{
+	htDelHashed(ht, name, length, hash_of(ht, name, length));
+}
+
+bool htHas(struct HT *ht, void const *name, HT_len length)
+{
+	return htHasHashed(ht, name, length, hash_of(ht, name, length));
+}
+
+void *htGet(struct HT *ht, void const *name, HT_len length)
+{
+	return htGetHashed(ht, name, length, hash_of(ht, name, length));
+}
+
+void *htGetOrInsert(struct HT *ht, void const *name, HT_len length, bool *inserted)
+{
+	return htGetOrInsertHashed(ht, name, length, hash_of(ht, name, length), inserted);
+}
+
+void htSetHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash, void *value)
+{
+	memcpy(htGetOrInsertHashed(ht, name, length, hash, NULL), value, ht->eSize);
+}
+
+void htDelHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash)
+{
+	migrate(ht);
+	struct HT_key key = make_key(name, length, hash);
+	struct search_result search = find(ht, key);
+	if (search.found) {
+		if (ht->flags & HT_STABLE_VALUES)
+			slab_release(ht, value_at(ht, search.slot));
+		remove_at(ht, search.slot);
+	} else if (ht->old != NULL && (search = find(ht->old, key)).found) {
+		if (ht->flags & HT_STABLE_VALUES)
+			slab_release(ht, value_at(ht->old, search.slot));
+		set_ctrl(ht->old, search.slot, HT_CTRL_MOVED);
+	} else {
+		return;
+	}
+	--ht->fill;
+	filter_forget(ht);
+	if ((double)ht->fill / (double)ht->cap < shrink_factor)
+		resize(ht, ht->cap / 2);
+	else if (ht->old == NULL && arena_wasted(ht))
+		rebuild(ht, ht->cap);
+}
+
+bool htHasHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash)
+{
+	return htGetHashed(ht, name, length, hash) != NULL;
+}
+
+static void *lookup(struct HT *ht, struct HT_key key)
+{
+	struct search_result search = find(ht, key);
+	if (search.found)
+		return value_of(ht, search.slot);
+	if (ht->old != NULL && (search = find(ht->old, key)).found)
+		return value_of(ht->old, search.slot);
+	return NULL;
+}
+
+void *htGetHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash)
+{
+	migrate(ht);
+	return lookup(ht, make_key(name, length, hash));
+}
+
+/* Every group of lookups goes through three passes: The first one hashes the keys and
+ * prefetches their home slots, the second one prefetches the key bytes of any home slot
+ * whose fingerprint matches, and the last one does the actual probing.
+ * The misses of one pass are all outstanding at the same time instead of one after another. */
+void htGetBatch(struct HT *ht, void const *const *names, HT_len const *lengths, size_t n, void **out)
+{
+	migrate(ht);
+	for (size_t base = 0; base < n; base += HT_BATCH) {
+		size_t count = n - base < HT_BATCH ? n - base : HT_BATCH;
+		struct HT_key keys[HT_BATCH];
+		size_t homes[HT_BATCH];
+		for (size_t i = 0; i < count; ++i) {
+			char const *name = names[base + i];
+			keys[i] = make_key(name, lengths[base + i], hash_of(ht, name, lengths[base + i]));
+			homes[i] = fold_slot(ht, keys[i].hash);
+			HT_PREFETCH(&ht->ctrl[homes[i]]);
+			HT_PREFETCH(&ht->keys[homes[i]]);
+		}
+		for (size_t i = 0; i < count; ++i) {
+			if (ht->ctrl[homes[i]] == fingerprint(keys[i].hash)) {
+				HT_PREFETCH(key_name(ht, &ht->keys[homes[i]]));
+				HT_PREFETCH(value_at(ht, homes[i]));
+			}
+		}
+		for (size_t i = 0; i < count; ++i)
+			out[base + i] = lookup(ht, keys[i]);
+	}
+}
+
+/* Also reports the slot of the entry, unless it is still in ht->old. */
+static void *get_or_insert(struct HT *ht, void const *name, HT_len length, HT_hash hash,
+	bool *inserted, size_t *slot)
+{
+	migrate(ht);
+	if ((double)(ht->fill + 1) / (double)ht->cap > load_factor)
+		resize(ht, ht->cap * 2);
+	struct HT_key key = make_key(name, length, hash);
+	struct search_result search;
+	if (inserted != NULL)
+		*inserted = false;
+	if (ht->old != NULL && (search = find(ht->old, key)).found) {
+		*slot = SIZE_MAX;
+		return value_of(ht->old, search.slot);
+	}
+	search = locate(ht, &key);
+	*slot = search.slot;
+	if (search.found)
+		return value_of(ht, search.slot);
+	++ht->fill;
+	if (ht->flags & HT_OWN_KEYS)
+		own_key(ht, &key, name);
+	char buf[ht->slotSize];
+	memset(buf, 0, ht->slotSize);
+	if (ht->flags & HT_STABLE_VALUES) {
+		size_t index = slab_acquire(ht);
+		memcpy(buf, &index, sizeof(index));
+	}
+	/* Entries only ever get pushed away from the insertion slot, never into it. */
+	insert_at(ht, key, buf, search.slot);
+	if (inserted != NULL)
+		*inserted = true;
+	return value_of(ht, search.slot);
+}
+
+void *htGetOrInsertHashed(struct HT *ht, void const *name, HT_len length, HT_hash hash, bool *inserted)
+{
+	size_t slot;
+	return get_or_insert(ht, name, length, hash, inserted, &slot);
+}
+
+/* ~~~~ STATISTICS ~~~~ */
+
+#if HT_OPTION_STATS
+
+static void stats_scan(struct HT *ht, struct HT_stats *stats, size_t *moved)
+{
+	for (size_t i = 0; i < ht->cap; ++i) {
+		if (ht->ctrl[i] == HT_CTRL_MOVED)
+			++*moved;
+		if (!is_live(ht, i))
+			continue;
+		size_t dist = dist_at(ht, i);
+		++stats->displacement[dist < HT_STATS_BUCKETS ? dist : HT_STATS_BUCKETS - 1];
+		if (dist > stats->maxDisplacement)
+			stats->maxDisplacement = dist;
+	}
+	stats->bytesAllocated += ht->cap * (sizeof(*ht->keys) + 1 + ht->slotSize) + HT_GROUP - 1 + ht->arenaCap;
+	if (ht->flags & HT_FILTER)
+		stats->bytesAllocated += filter_blocks(ht->cap) * 8 * sizeof(*ht->filter);
+}
+
+static void stats_slab(struct HT *ht, struct HT_stats *stats)
+{
+	struct HT_slab *slab = ht->slab;
+	size_t chunks = (slab->used + HT_SLAB_CHUNK - 1) / HT_SLAB_CHUNK;
+	stats->bytesAllocated += sizeof(*slab) + chunks * HT_SLAB_CHUNK * ht->eSize
+		+ slab->chunkCap * sizeof(*slab->chunks) + slab->freeCap * sizeof(*slab->free);
+}
+
+void htStats(struct HT *ht, struct HT_stats *stats)
+{
+	*stats = (struct HT_stats){0};
+	struct HT_counters counters = ht->counters;
+	size_t moved = 0;
+	stats_scan(ht, stats, &moved);
+	if (ht->flags & HT_STABLE_VALUES)
+		stats_slab(ht, stats);
+	if (ht->old != NULL) {
+		stats_scan(ht->old, stats, &moved);
+		stats->bytesAllocated += sizeof(*ht->old);
+		stats->tombstoneDensity = (double)moved / ht->old->cap;
+		counters.lookups += ht->old->counters.lookups;
+		counters.compares += ht->old->counters.compares;
+		for (int b = 0; b < HT_STATS_BUCKETS; ++b)
+			counters.probes[b] += ht->old->counters.probes[b];
+	}
+	memcpy(stats->probeLength, counters.probes, sizeof(counters.probes));
+	stats->comparesPerLookup = counters.lookups ? (double)counters.compares / counters.lookups : 0;
+	stats->rebuilds = counters.rebuilds;
+	stats->shrinks = counters.shrinks;
+}
+
+#endif
+
+/* ~~~~ SNAPSHOTS ~~~~ */
+
+#include <stdio.h>
+
+/* A snapshot file is this header, followed by the key, control byte, value
+ * and key arena arrays, each starting at a multiple of HT_SNAPSHOT_ALIGN. */
+struct HT_snapshot
+{
+	char magic[8];
+	uint32_t byteOrder;
+	/* Tell tables built with and without HT_OPTION_WIDE apart. */
+	uint16_t keySize;
+	uint16_t lengthSize;
+	uint64_t eSize;
+	uint64_t cap;
+	uint64_t fill;
+	uint64_t seed;
+	uint64_t arenaSize;
+	uint64_t keys;
+	uint64_t ctrl;
+	uint64_t values;
+	uint64_t arena;
+};
+
+#define HT_SNAPSHOT_MAGIC	"HTSNAP1"
+#define HT_SNAPSHOT_ALIGN	64
+/* The control bytes are mirrored for the widest group of all, so that
+ * a snapshot can be opened regardless of HT_OPTION_SIMD. */
+#define HT_SNAPSHOT_MIRROR	31
+_Static_assert(HT_GROUP - 1 <= HT_SNAPSHOT_MIRROR, "snapshots don't mirror enough control bytes");
+
+static uint64_t snapshot_align(uint64_t offset)
+{ return (offset + HT_SNAPSHOT_ALIGN - 1) & ~(uint64_t)(HT_SNAPSHOT_ALIGN - 1); }
+
+static bool write_bytes(FILE *file, uint64_t *pos, void const *data, size_t size)
+{
+	*pos += size;
+	return fwrite(data, 1, size, file) == size;
+}
+
+static bool pad_to(FILE *file, uint64_t *pos, uint64_t offset)
+{
+	static char const zeros[HT_SNAPSHOT_ALIGN];
+	return write_bytes(file, pos, zeros, offset - *pos);
+}
+
+/* Borrowed keys are turned into owned ones on the way: the short ones
+ * are stored inline, the rest one after another in the arena. */
+static struct HT_key snapshot_key(struct HT *ht, size_t slot, uint64_t *arenaFill)
+{
+	struct HT_key key = {0};
+	if (!is_live(ht, slot))
+		return key;
+	key = ht->keys[slot];
+	if (ht->flags & HT_OWN_KEYS)
+		return key;
+	char const *name = key.name;
+	if (key.length <= HT_INLINE_KEY) {
+		memset(key.bytes, 0, sizeof(key.bytes));
+		memcpy(key.bytes, name, key.length);
+	} else {
+		key.offset = *arenaFill;
+		*arenaFill += key.length;
+	}
+	return key;
+}
+
+bool htSave(struct HT *ht, char const *path)
+{
+	while (ht->old != NULL)
+		migrate(ht);
+	bool owned = ht->flags & HT_OWN_KEYS;
+	uint64_t arenaSize = owned ? ht->arenaFill : 0;
+	for (size_t i = 0; i < ht->cap && !owned; ++i)
+		snapshot_key(ht, i, &arenaSize);
+
+	struct HT_snapshot header = {
+		.magic = HT_SNAPSHOT_MAGIC,
+		.byteOrder = 0x01020304,
+		.keySize = sizeof(struct HT_key),
+		.lengthSize = sizeof(HT_len),
+		.eSize = ht->eSize,
+		.cap = ht->cap,
+		.fill = ht->fill,
+		.seed = ht->seed,
+		.arenaSize = arenaSize,
+	};
+	header.keys = snapshot_align(sizeof(header));
+	header.ctrl = snapshot_align(header.keys + ht->cap * sizeof(struct HT_key));
+	header.values = snapshot_align(header.ctrl + ht->cap + HT_SNAPSHOT_MIRROR);
+	header.arena = snapshot_align(header.values + ht->cap * ht->eSize);
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	uint64_t pos = 0, arenaFill = 0;
+	bool ok = write_bytes(file, &pos, &header, sizeof(header)) && pad_to(file, &pos, header.keys);
+	for (size_t i = 0; ok && i < ht->cap; ++i) {
+		struct HT_key key = snapshot_key(ht, i, &arenaFill);
+		ok = write_bytes(file, &pos, &key, sizeof(key));
+	}
+	ok = ok && pad_to(file, &pos, header.ctrl) && write_bytes(file, &pos, ht->ctrl, ht->cap);
+	for (size_t i = 0; ok && i < HT_SNAPSHOT_MIRROR; ++i)
+		ok = write_bytes(file, &pos, &ht->ctrl[i % ht->cap], 1);
+	ok = ok && pad_to(file, &pos, header.values);
+	if (!(ht->flags & HT_STABLE_VALUES)) {
+		ok = ok && write_bytes(file, &pos, ht->values, ht->cap * ht->eSize);
+	} else {
+		/* The values are written in place of their indices, so the mapped table needs no slab. */
+		char empty[ht->eSize];
+		memset(empty, 0, ht->eSize);
+		for (size_t i = 0; ok && i < ht->cap; ++i)
+			ok = write_bytes(file, &pos, is_live(ht, i) ? value_of(ht, i) : empty, ht->eSize);
+	}
+	ok = ok && pad_to(file, &pos, header.arena);
+	if (owned) {
+		ok = ok && write_bytes(file, &pos, ht->arena, ht->arenaFill);
+	} else {
+		for (size_t i = 0; ok && i < ht->cap; ++i) {
+			if (is_live(ht, i) && ht->keys[i].length > HT_INLINE_KEY)
+				ok = write_bytes(file, &pos, ht->keys[i].name, ht->keys[i].length);
+		}
+	}
+	if (fclose(file) != 0)
+		ok = false;
+	return ok;
+}
+
+#if HT_HAVE_MMAP
+
+/* Checks that every section is where htSave would have put it, and that all fit into the file. */
+static bool snapshot_valid(struct HT_snapshot const *header, uint64_t size)
+{
+	if (memcmp(header->magic, HT_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+		|| header->byteOrder != 0x01020304 || header->keySize != sizeof(struct HT_key)
+		|| header->lengthSize != sizeof(HT_len))
+		return false;
+	uint64_t cap = header->cap;
+	/* The bounds on cap and eSize keep the offset math below from overflowing. */
+	if (cap == 0 || (cap & (cap - 1)) != 0 || cap > size || header->fill > cap
+		|| header->eSize == 0 || header->eSize > size / cap)
+		return false;
+	uint64_t keys = snapshot_align(sizeof(*header));
+	uint64_t ctrl = snapshot_align(keys + cap * sizeof(struct HT_key));
+	uint64_t values = snapshot_align(ctrl + cap + HT_SNAPSHOT_MIRROR);
+	uint64_t arena = snapshot_align(values + cap * header->eSize);
+	return header->keys == keys && header->ctrl == ctrl && header->values == values
+		&& header->arena == arena && arena <= size && header->arenaSize == size - arena;
+}
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool htOpenMapped(struct HT *ht, char const *path, HT_hash_fn hash)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void *base = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct HT_snapshot))
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+	struct HT_snapshot const *header = base;
+	if (!snapshot_valid(header, st.st_size)) {
+		munmap(base, st.st_size);
+		return false;
+	}
+	char *bytes = base;
+	*ht = (struct HT){
+		.cap = header->cap,
+		.eSize = header->eSize,
+		.slotSize = header->eSize,
+		.fill = header->fill,
+		.flags = HT_OWN_KEYS | HT_MAPPED,
+		.hash = hash != NULL ? hash : htHashWy,
+		.seed = header->seed,
+		.allocator = &htDefaultAllocator,
+		.keys = (struct HT_key *)(bytes + header->keys),
+		.ctrl = (unsigned char *)(bytes + header->ctrl),
+		.values = bytes + header->values,
+		.arena = bytes + header->arena,
+		.arenaFill = header->arenaSize,
+		.arenaCap = header->arenaSize,
+	};
+	return true;
+}
+
+/* The mapping starts with the header right before the keys, and ends with the arena. */
+static void unmap_snapshot(struct HT *ht)
+{
+	char *base = (char *)ht->keys - snapshot_align(sizeof(struct HT_snapshot));
+	munmap(base, ht->arena + ht->arenaCap - base);
+}
+
+#endif
+
+/* ~~~~ FROZEN TABLES ~~~~ */
+
+/* Smaller buckets make pilots quicker to find, but there are more of them to store. */
+#define HTF_BUCKET_SIZE	3
+/* The fraction of the range slots are picked from that ends up taken. */
+#define HTF_LOAD	0.97
+
+/* Frozen tables always use their own 64-bit hash, since with a 32-bit one, keys with
+ * identical hashes would be all but certain in large tables, and they can't be separated. */
+static size_t htf_bucket(struct HTF const *htf, uint64_t hash)
+{ return (size_t)(((hash >> 32) * (uint64_t)htf->buckets) >> 32); }
+
+static size_t htf_slot(struct HTF const *htf, uint64_t hash, uint32_t pilot)
+{ return (hash ^ wy_mix(pilot ^ wy_secret[2], wy_secret[3])) % htf->range; }
+
+static bool test_bit(uint64_t const *bits, size_t i)
+{ return bits[i / 64] >> (i % 64) & 1; }
+
+static void flip_bit(uint64_t *bits, size_t i)
+{ bits[i / 64] ^= (uint64_t)1 << (i % 64); }
+
+/* Tries to place the count keys of a bucket with the given pilot, marking their slots as taken. */
+static bool htf_try(struct HTF *htf, uint64_t const *hashes, size_t const *members, size_t count,
+	uint32_t pilot, uint64_t *taken, size_t *slots)
+{
+	for (size_t i = 0; i < count; ++i) {
+		size_t slot = htf_slot(htf, hashes[members[i]], pilot);
+		if (test_bit(taken, slot)) {
+			while (i-- > 0)
+				flip_bit(taken, slots[members[i]]);
+			return false;
+		}
+		flip_bit(taken, slot);
+		slots[members[i]] = slot;
+	}
+	return true;
+}
+
+/* Tries to find pilots for all buckets, filling in the slot of each entry. Buckets
+ * are handled from the biggest to the smallest, while there's still plenty of room.
+ * Fails when two keys share their whole hash, in which case a different seed is needed. */
+static bool htf_place(struct HTF *htf, uint64_t const *hashes, size_t *slots)
+{
+	struct HT_allocator const *a = htf->allocator;
+	size_t n = htf->fill, nb = htf->buckets;
+	size_t *starts = allocate(a, (nb + 1) * sizeof(*starts));
+	for (size_t i = 0; i < n; ++i)
+		++starts[htf_bucket(htf, hashes[i]) + 1];
+	size_t maxSize = 0;
+	for (size_t b = 0; b < nb; ++b) {
+		if (starts[b + 1] > maxSize)
+			maxSize = starts[b + 1];
+		starts[b + 1] += starts[b];
+	}
+	size_t *next = allocate(a, nb * sizeof(*next));
+	size_t *members = allocate(a, n * sizeof(*members));
+	memcpy(next, starts, nb * sizeof(*next));
+	for (size_t i = 0; i < n; ++i)
+		members[next[htf_bucket(htf, hashes[i])]++] = i;
+
+	/* Counting sort of the buckets by descending size. */
+	size_t *bySize = allocate(a, (maxSize + 2) * sizeof(*bySize));
+	size_t *order = allocate(a, nb * sizeof(*order));
+	for (size_t b = 0; b < nb; ++b)
+		++bySize[maxSize - (starts[b + 1] - starts[b]) + 1];
+	for (size_t k = 0; k <= maxSize; ++k)
+		bySize[k + 1] += bySize[k];
+	for (size_t b = 0; b < nb; ++b)
+		order[bySize[maxSize - (starts[b + 1] - starts[b])]++] = b;
+
+	uint64_t *taken = allocate(a, (htf->range / 64 + 1) * sizeof(*taken));
+	bool ok = true;
+	for (size_t k = 0; ok && k < nb; ++k) {
+		size_t b = order[k], first = starts[b], count = starts[b + 1] - first;
+		if (count == 0)
+			break;
+		for (size_t i = first; i < first + count; ++i) {
+			for (size_t j = first; j < i; ++j)
+				ok = ok && hashes[members[i]] != hashes[members[j]];
+		}
+		uint32_t pilot = 0;
+		while (ok && !htf_try(htf, hashes, &members[first], count, pilot, taken, slots))
+			ok = ++pilot != 0;
+		htf->pilots[b] = pilot;
+	}
+	/* Exactly as many slots below fill are left free as were taken past it. */
+	for (size_t s = n, free = 0; ok && s < htf->range; ++s) {
+		if (!test_bit(taken, s))
+			continue;
+		while (test_bit(taken, free))
+			++free;
+		htf->remap[s - n] = free++;
+	}
+	for (size_t i = 0; ok && i < n; ++i) {
+		if (slots[i] >= n)
+			slots[i] = htf->remap[slots[i] - n];
+	}
+	deallocate(a, taken, (htf->range / 64 + 1) * sizeof(*taken));
+	deallocate(a, order, nb * sizeof(*order));
+	deallocate(a, bySize, (maxSize + 2) * sizeof(*bySize));
+	deallocate(a, members, n * sizeof(*members));
+	deallocate(a, next, nb * sizeof(*next));
+	deallocate(a, starts, (nb + 1) * sizeof(*starts));
+	return ok;
+}
+
+struct HTF htFreeze(struct HT *ht)
+{
+	while (ht->old != NULL)
+		migrate(ht);
+	struct HTF htf = {.fill = ht->fill, .eSize = ht->eSize, .seed = ht->seed, .allocator = ht->allocator};
+	htf.buckets = ht->fill / HTF_BUCKET_SIZE + 1;
+	htf.pilots = allocate(htf.allocator, htf.buckets * sizeof(*htf.pilots));
+	htf.range = ht->fill / HTF_LOAD + 1;
+	htf.remap = allocate(htf.allocator, (htf.range - ht->fill) * sizeof(*htf.remap));
+	htf.offsets = allocate(htf.allocator, (ht->fill + 1) * sizeof(*htf.offsets));
+	htf.values = allocate(htf.allocator, ht->fill * ht->eSize);
+
+	size_t n = 0, *entries = allocate(htf.allocator, ht->fill * sizeof(*entries));
+	for (size_t i = 0; i < ht->cap; ++i) {
+		if (is_live(ht, i))
+			entries[n++] = i;
+	}
+	uint64_t *hashes = allocate(htf.allocator, n * sizeof(*hashes));
+	size_t *slots = allocate(htf.allocator, n * sizeof(*slots));
+	for (;;) {
+		for (size_t i = 0; i < n; ++i) {
+			struct HT_key const *key = &ht->keys[entries[i]];
+			hashes[i] = wy_hash(key_name(ht, key), key->length, htf.seed);
+		}
+		if (n == 0 || htf_place(&htf, hashes, slots))
+			break;
+		htf.seed = wy_mix(htf.seed ^ wy_secret[0], wy_secret[1]);
+	}
+
+	/* Lay everything out in slot order, reusing hashes for the entry in each slot. */
+	for (size_t i = 0; i < n; ++i)
+		hashes[slots[i]] = entries[i];
+	for (size_t s = 0; s < n; ++s)
+		htf.offsets[s + 1] = htf.offsets[s] + ht->keys[hashes[s]].length;
+	htf.arena = allocate(htf.allocator, htf.offsets[n]);
+	for (size_t s = 0; s < n; ++s) {
+		struct HT_key const *key = &ht->keys[hashes[s]];
+		memcpy(htf.arena + htf.offsets[s], key_name(ht, key), key->length);
+		memcpy(&htf.values[s * htf.eSize], value_of(ht, hashes[s]), htf.eSize);
+	}
+	deallocate(htf.allocator, slots, n * sizeof(*slots));
+	deallocate(htf.allocator, hashes, n * sizeof(*hashes));
+	deallocate(htf.allocator, entries, ht->fill * sizeof(*entries));
+	return htf;
+}
+
+void htfFree(struct HTF *htf)
+{
+	deallocate(htf->allocator, htf->pilots, htf->buckets * sizeof(*htf->pilots));
+	deallocate(htf->allocator, htf->remap, (htf->range - htf->fill) * sizeof(*htf->remap));
+	deallocate(htf->allocator, htf->arena, htf->offsets[htf->fill]);
+	deallocate(htf->allocator, htf->offsets, (htf->fill + 1) * sizeof(*htf->offsets));
+	deallocate(htf->allocator, htf->values, htf->fill * htf->eSize);
+}
+
+bool htfHas(struct HTF *htf, void const *name, HT_len length)
+{
+	return htfGet(htf, name, length) != NULL;
+}
+
+void *htfGet(struct HTF *htf, void const *name, HT_len length)
+{
+	if (htf->fill == 0)
+		return NULL;
+	uint64_t hash = wy_hash(name, length, htf->seed);
+	size_t slot = htf_slot(htf, hash, htf->pilots[htf_bucket(htf, hash)]);
+	if (slot >= htf->fill)
+		slot = htf->remap[slot - htf->fill];
+	size_t start = htf->offsets[slot];
+	if (htf->offsets[slot + 1] - start != (size_t)length || memcmp(htf->arena + start, name, length) != 0)
+		return NULL;
+	return &htf->values[slot * htf->eSize];
+}
+
+/* ~~~~ CACHES ~~~~ */
+
+/* The reference bit comes after the value, at the value's alignment. */
+static int cache_stride(int eSize)
+{
+	int align = eSize & -eSize;
+	if (align == 0)
+		align = 1;
+	if (align > 16)
+		align = 16;
+	return (eSize + align) / align * align;
+}
+
+static unsigned char *cache_bit(struct HT_cache *cache, size_t slot)
+{ return (unsigned char *)value_of(&cache->ht, slot) + cache->eSize; }
+
+static size_t cache_charge(struct HT_cache *cache, HT_len length)
+{ return (size_t)length + cache->eSize; }
+
+struct HT_cache htCacheNew(size_t maxEntries, size_t maxBytes, int eSize, struct HT_params const *params)
+{
+	struct HT_params tableParams = *params;
+	tableParams.flags &= ~HT_INCREMENTAL;
+	/* With a limit on the entries, the table never has to grow. New entries
+	 * are inserted before evicting, so there has to be room for one more. */
+	size_t cap = maxEntries > 0 ? (size_t)((maxEntries + 1) / load_factor) + 1 : 1;
+	return (struct HT_cache){
+		.ht = htNewWith(cap, cache_stride(eSize), &tableParams),
+		.eSize = eSize,
+		.maxEntries = maxEntries,
+		.maxBytes = maxBytes,
+	};
+}
+
+void htCacheFree(struct HT_cache *cache)
+{
+	htFree(&cache->ht);
+}
+
+/* Removes the entry without shrinking the table, which would only have to grow back. */
+static void cache_evict(struct HT_cache *cache, size_t slot)
+{
+	struct HT *ht = &cache->ht;
+	cache->bytes -= cache_charge(cache, ht->keys[slot].length);
+	if (ht->flags & HT_STABLE_VALUES)
+		slab_release(ht, value_at(ht, slot));
+	remove_at(ht, slot);
+	--ht->fill;
+	filter_forget(ht);
+}
+
+/* Where the entry in slot keep ends up once the one in slot has been removed. */
+static size_t cache_shifted(struct HT *ht, size_t slot, size_t keep)
+{
+	for (size_t next = advance(ht, slot);; next = advance(ht, next)) {
+		if (is_empty(ht, next) || dist_at(ht, next) == 0)
+			return keep;
+		if (next == keep)
+			return fold_slot(ht, keep + ht->cap - 1);
+	}
+}
+
+/* Sweeping the slots in order would empty the table behind the hand while it fills up
+ * ahead of it, until the clusters there get long enough to slow everything down. So the
+ * hand takes steps of the golden ratio instead, which spreads evictions evenly over the
+ * table. Evicting shifts the next entries back into the slot, so the hand stays where it is.
+ * The entry in slot *keep is passed over, and *keep follows it when it gets shifted. */
+static void cache_sweep(struct HT_cache *cache, size_t *keep)
+{
+	struct HT *ht = &cache->ht;
+	size_t stride = (size_t)(ht->cap * 0.6180339887498949) | 1;
+	for (;;) {
+		size_t slot = cache->hand * stride & (ht->cap - 1);
+		if (!is_live(ht, slot) || slot == *keep) {
+			++cache->hand;
+		} else if (*cache_bit(cache, slot)) {
+			*cache_bit(cache, slot) = 0;
+			++cache->hand;
+		} else {
+			*keep = cache_shifted(ht, slot, *keep);
+			cache_evict(cache, slot);
+			return;
+		}
+	}
+}
+
+void *htCacheGet(struct HT_cache *cache, void const *name, HT_len length)
+{
+	struct HT *ht = &cache->ht;
+	struct search_result search = find(ht, make_key(name, length, hash_of(ht, name, length)));
+	if (!search.found)
+		return NULL;
+	*cache_bit(cache, search.slot) = 1;
+	return value_of(ht, search.slot);
+}
+
+/* The table is only probed once: A new entry goes in first, and then makes room
+ * for itself by evicting others, with its slot followed as they shift it back. */
+void *htCachePut(struct HT_cache *cache, void const *name, HT_len length, void const *value)
+{
+	struct HT *ht = &cache->ht;
+	size_t charge = cache_charge(cache, length);
+	if (cache->maxBytes > 0 && charge > cache->maxBytes)
+		return NULL;
+	/* The keys of evicted entries are dropped from the arena here, where no slot is held on to. */
+	if (arena_wasted(ht))
+		rebuild(ht, ht->cap);
+	bool inserted;
+	size_t slot;
+	void *stored = get_or_insert(ht, name, length, hash_of(ht, name, length), &inserted, &slot);
+	if (!inserted) {
+		*cache_bit(cache, slot) = 1;
+		return memcpy(stored, value, cache->eSize);
+	}
+	cache->bytes += charge;
+	while ((cache->maxEntries > 0 && ht->fill > cache->maxEntries)
+		|| (cache->maxBytes > 0 && cache->bytes > cache->maxBytes))
+		cache_sweep(cache, &slot);
+	return memcpy(value_of(ht, slot), value, cache->eSize);
+}
+
+void htCacheDel(struct HT_cache *cache, void const *name, HT_len length)
+{
+	struct HT *ht = &cache->ht;
+	struct search_result search = find(ht, make_key(name, length, hash_of(ht, name, length)));
+	if (search.found) {
+		cache_evict(cache, search.slot);
+		if (arena_wasted(ht))
+			rebuild(ht, ht->cap);
+	}
+}
+
+/* ~~~~ ORDERED TABLES ~~~~ */
+
+/* Marks deleted entries in their dist field, which the entries array has no other use for. */
+#define HTO_DELETED	0xFFFF
+
+/* The entries array only has room for as many entries as the slots can take. */
+static size_t hto_usable(size_t cap)
+{ return (size_t)(cap * load_factor); }
+
+static int hto_width(size_t cap)
+{ return cap <= 1u << 8 ? 1 : cap <= 1u << 16 ? 2 : cap <= 0xFFFFFFFFu ? 4 : 8; }
+
+/* Empty slots hold all ones, which no entry index ever reaches. */
+static size_t hto_empty(struct HTO *hto)
+{ return hto->width == 8 ? SIZE_MAX : ((size_t)1 << hto->width * 8) - 1; }
+
+static size_t hto_get(struct HTO *hto, size_t slot)
+{
+	switch (hto->width) {
+	case 1: return ((uint8_t *)hto->index)[slot];
+	case 2: return ((uint16_t *)hto->index)[slot];
+	case 4: return ((uint32_t *)hto->index)[slot];
+	default: return ((uint64_t *)hto->index)[slot];
+	}
+}
+
+static void hto_put(struct HTO *hto, size_t slot, size_t entry)
+{
+	switch (hto->width) {
+	case 1: ((uint8_t *)hto->index)[slot] = entry; break;
+	case 2: ((uint16_t *)hto->index)[slot] = entry; break;
+	case 4: ((uint32_t *)hto->index)[slot] = entry; break;
+	default: ((uint64_t *)hto->index)[slot] = entry; break;
+	}
+}
+
+static size_t hto_next(struct HTO *hto, size_t slot)
+{ return (slot + 1) & (hto->cap - 1); }
+
+static size_t hto_dist(struct HTO *hto, size_t slot, size_t entry)
+{ return (slot - hto->base.keys[entry].hash) & (hto->cap - 1); }
+
+/* On success, returns the slot of the entry. Otherwise, returns where it would have to go. */
+static struct search_result hto_locate(struct HTO *hto, struct HT_key const *key)
+{
+	HT_COUNT(&hto->base, lookups);
+	size_t slot = key->hash & (hto->cap - 1), empty = hto_empty(hto);
+	for (size_t dist = 0;; ++dist) {
+		size_t entry = hto_get(hto, slot);
+		if (entry == empty || hto_dist(hto, slot, entry) < dist)
+			return (struct search_result){false, slot};
+		if (does_match(&hto->base, &hto->base.keys[entry], key))
+			return (struct search_result){true, slot};
+		slot = hto_next(hto, slot);
+	}
+}
+
+/* Slots stay sorted by their home slot if everything up to the next empty one moves over. */
+static void hto_insert(struct HTO *hto, size_t slot, size_t entry)
+{
+	size_t empty = hto_empty(hto);
+	while (entry != empty) {
+		size_t next = hto_get(hto, slot);
+		hto_put(hto, slot, entry);
+		entry = next;
+		slot = hto_next(hto, slot);
+	}
+}
+
+static void hto_remove(struct HTO *hto, size_t slot)
+{
+	size_t empty = hto_empty(hto);
+	for (;;) {
+		size_t next = hto_next(hto, slot), entry = hto_get(hto, next);
+		if (entry == empty || hto_dist(hto, next, entry) == 0)
+			break;
+		hto_put(hto, slot, entry);
+		slot = next;
+	}
+	hto_put(hto, slot, empty);
+}
+
+/* Squeezes out the holes, and with them the bytes of deleted keys from the arena. */
+static void hto_compact(struct HTO *hto)
+{
+	struct HT *base = &hto->base;
+	char *arena = base->arena;
+	size_t arenaCap = base->arenaCap, n = 0;
+	base->arena = NULL;
+	base->arenaFill = base->arenaCap = base->arenaDead = 0;
+	for (size_t i = 0; i < base->fill; ++i) {
+		struct HT_key key = base->keys[i];
+		if (key.dist == HTO_DELETED)
+			continue;
+		if ((base->flags & HT_OWN_KEYS) && key.length > HT_INLINE_KEY)
+			own_key(base, &key, arena + key.offset);
+		base->keys[n] = key;
+		memmove(value_at(base, n), value_at(base, i), base->eSize);
+		++n;
+	}
+	deallocate(base->allocator, arena, arenaCap);
+	base->fill = n;
+}
+
+static void hto_rebuild(struct HTO *hto, size_t cap)
+{
+	struct HT *base = &hto->base;
+	if (hto->live < base->fill)
+		hto_compact(hto);
+	size_t usable = hto_usable(hto->cap), newUsable = hto_usable(cap);
+	base->keys = reallocate(base->allocator, base->keys,
+		usable * sizeof(*base->keys), newUsable * sizeof(*base->keys));
+	base->values = reallocate(base->allocator, base->values,
+		usable * base->eSize, newUsable * base->eSize);
+	deallocate(base->allocator, hto->index, hto->cap * hto->width);
+	hto->cap = cap;
+	hto->width = hto_width(cap);
+	hto->index = allocate(base->allocator, cap * hto->width);
+	memset(hto->index, 0xFF, cap * hto->width);
+	/* The keys are known to be distinct, so only their distances have to be compared. */
+	size_t empty = hto_empty(hto);
+	for (size_t i = 0; i < base->fill; ++i) {
+		size_t slot = base->keys[i].hash & (cap - 1), entry;
+		for (size_t dist = 0; (entry = hto_get(hto, slot)) != empty; ++dist) {
+			if (hto_dist(hto, slot, entry) < dist)
+				break;
+			slot = hto_next(hto, slot);
+		}
+		hto_insert(hto, slot, i);
+	}
+}
+
+struct HTO htoNew(size_t cap, int eSize, struct HT_params const *params)
+{
+	struct HTO hto = {.base = {.eSize = eSize, .slotSize = eSize}};
+	struct HT *base = &hto.base;
+	base->flags = params->flags & (HT_OWN_KEYS | HT_RANDOM_SEED);
+	base->hash = params->hash != NULL ? params->hash : htHashWy;
+	base->seed = params->flags & HT_RANDOM_SEED ? random_seed() : params->seed;
+	base->allocator = params->allocator != NULL ? params->allocator : &htDefaultAllocator;
+	hto.cap = round_capacity(cap > 2 ? cap : 2);
+	hto.width = hto_width(hto.cap);
+	base->keys = allocate(base->allocator, hto_usable(hto.cap) * sizeof(*base->keys));
+	base->values = allocate(base->allocator, hto_usable(hto.cap) * eSize);
+	hto.index = allocate(base->allocator, hto.cap * hto.width);
+	memset(hto.index, 0xFF, hto.cap * hto.width);
+	return hto;
+}
+
+void htoFree(struct HTO *hto)
+{
+	struct HT *base = &hto->base;
+	deallocate(base->allocator, base->keys, hto_usable(hto->cap) * sizeof(*base->keys));
+	deallocate(base->allocator, base->values, hto_usable(hto->cap) * base->eSize);
+	deallocate(base->allocator, base->arena, base->arenaCap);
+	deallocate(base->allocator, hto->index, hto->cap * hto->width);
+}
+
+void htoSet(struct HTO *hto, void const *name, HT_len length, void *value)
+{
+	struct HT *base = &hto->base;
+	struct HT_key key = make_key(name, length, hash_of(base, name, length));
+	struct search_result search = hto_locate(hto, &key);
+	if (search.found) {
+		memcpy(value_at(base, hto_get(hto, search.slot)), value, base->eSize);
+		return;
+	}
+	/* If half of the entries are holes, squeezing them out makes enough room. */
+	if (base->fill == hto_usable(hto->cap)) {
+		hto_rebuild(hto, hto->live < base->fill / 2 ? hto->cap : 2 * hto->cap);
+		search = hto_locate(hto, &key);
+	}
+	size_t entry = base->fill++;
+	if (base->flags & HT_OWN_KEYS)
+		own_key(base, &key, name);
+	base->keys[entry] = key;
+	memcpy(value_at(base, entry), value, base->eSize);
+	++hto->live;
+	hto_insert(hto, search.slot, entry);
+}
+
+void htoDel(struct HTO *hto, void const *name, HT_len length)
+{
+	struct HT_key key = make_key(name, length, hash_of(&hto->base, name, length));
+	struct search_result search = hto_locate(hto, &key);
+	if (!search.found)
+		return;
+	hto->base.keys[hto_get(hto, search.slot)].dist = HTO_DELETED;
+	hto_remove(hto, search.slot);
+	--hto->live;
+}
+
+bool htoHas(struct HTO *hto, void const *name, HT_len length)
+{
+	return htoGet(hto, name, length) != NULL;
+}
+
+void *htoGet(struct HTO *hto, void const *name, HT_len length)
+{
+	struct HT_key key = make_key(name, length, hash_of(&hto->base, name, length));
+	struct search_result search = hto_locate(hto, &key);
+	return search.found ? value_at(&hto->base, hto_get(hto, search.slot)) : NULL;
+}
+
+bool htoNext(struct HTO *hto, size_t *cursor, void const **name, HT_len *length, void **value)
+{
+	struct HT *base = &hto->base;
+	while (*cursor < base->fill) {
+		size_t entry = (*cursor)++;
+		struct HT_key const *key = &base->keys[entry];
+		if (key->dist == HTO_DELETED)
+			continue;
+		*name = key_name(base, key);
+		*length = key->length;
+		*value = value_at(base, entry);
+		return true;
+	}
+	return false;
+}
+
+/* ~~~~ CONCURRENT TABLES ~~~~ */
+
+#if HT_OPTION_CONCURRENT
+
+#include <sched.h>
+
+static struct HTC_shard *shard_of(struct HTC *htc, HT_hash hash)
+{
+	/* The top bits of the hash itself are already taken by the fingerprint. */
+	return &htc->shards[(uint64_t)hash * 0x9E3779B97F4A7C15ull >> (64 - HTC_SHARD_BITS)];
+}
+
+static atomic_uint *htc_enter(struct HTC *htc)
+{
+	static atomic_uint thread_counter;
+	static _Thread_local unsigned thread_slot;
+	if (thread_slot == 0)
+		thread_slot = atomic_fetch_add(&thread_counter, 1) + 1;
+	struct HTC_readers *readers = &htc->readers[thread_slot % HTC_READER_SLOTS];
+	for (;;) {
+		unsigned epoch = atomic_load(&htc->epoch);
+		atomic_fetch_add(&readers->count[epoch & 1], 1);
+		if (atomic_load(&htc->epoch) == epoch)
+			return &readers->count[epoch & 1];
+		atomic_fetch_sub(&readers->count[epoch & 1], 1);
+	}
+}
+
+static void htc_leave(atomic_uint *counter)
+{
+	atomic_fetch_sub_explicit(counter, 1, memory_order_release);
+}
+
+void htcSynchronize(struct HTC *htc)
+{
+	pthread_mutex_lock(&htc->epochLock);
+	unsigned epoch = atomic_fetch_add(&htc->epoch, 1);
+	for (int i = 0; i < HTC_READER_SLOTS; ++i) {
+		while (atomic_load(&htc->readers[i].count[epoch & 1]) != 0)
+			sched_yield();
+	}
+	pthread_mutex_unlock(&htc->epochLock);
+}
+
+static void htc_write_begin(struct HTC_shard *shard)
+{
+	unsigned seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+	atomic_store_explicit(&shard->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void htc_write_end(struct HTC_shard *shard)
+{
+	unsigned seq = atomic_load_explicit(&shard->seq, memory_order_relaxed);
+	atomic_store_explicit(&shard->seq, seq + 1, memory_order_release);
+}
+
+static bool htc_changed(struct HTC_shard *shard, unsigned seq)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&shard->seq, memory_order_relaxed) != seq;
+}
+
+/* Readers keep using the old table until the new one is published, so they never have to wait. */
+static struct HT *htc_resize(struct HTC *htc, struct HTC_shard *shard, struct HT *table, size_t cap)
+{
+	struct HT *new = allocate(table->allocator, sizeof(*new));
+	*new = *table;
+	alloc_arrays(new, cap);
+	for (size_t i = 0; i < table->cap; ++i) {
+		if (is_live(table, i))
+			migrate_entry(new, table, i);
+	}
+	atomic_store_explicit(&shard->table, new, memory_order_release);
+	htcSynchronize(htc);
+	free_arrays(table);
+	deallocate(table->allocator, table, sizeof(*table));
+	return new;
+}
+
+/* Like find(), but the table may be modified concurrently. So the key has
+ * to be validated before its bytes are compared, and the value copied out
+ * before the caller validates the whole result. */
+static bool htc_find(struct HT *table, struct HTC_shard *shard, unsigned seq, struct HT_key key, void *out)
+{
+	unsigned char fp = fingerprint(key.hash);
+	size_t pos = fold_slot(table, key.hash);
+	for (size_t n = 0; n < table->cap; n += HT_GROUP) {
+		uint32_t match = group_match(&table->ctrl[pos], fp);
+		uint32_t empty = group_match(&table->ctrl[pos], HT_CTRL_EMPTY);
+		if (empty)
+			match &= (empty & -empty) - 1;
+		while (match) {
+			size_t slot = fold_slot(table, pos + HT_CTZ(match));
+			struct HT_key other = table->keys[slot];
+			if (other.hash == key.hash && other.length == key.length) {
+				if (htc_changed(shard, seq))
+					return false;
+				if (memcmp(other.name, key.name, key.length) == 0) {
+					if (out != NULL)
+						memcpy(out, value_at(table, slot), table->eSize);
+					return true;
+				}
+			}
+			match &= match - 1;
+		}
+		if (empty)
+			break;
+		pos = fold_slot(table, pos + HT_GROUP);
+	}
+	return false;
+}
+
+struct HTC *htcNew(size_t cap, int eSize, struct HT_params const *params)
+{
+	struct HTC *htc = aligned_alloc(_Alignof(struct HTC), sizeof(*htc));
+	htc->eSize = eSize;
+	htc->hash = params->hash != NULL ? params->hash : htHashWy;
+	htc->seed = params->flags & HT_RANDOM_SEED ? random_seed() : params->seed;
+	struct HT_allocator const *allocator = params->allocator != NULL ? params->allocator : &htDefaultAllocator;
+	struct HT_params shardParams = {.hash = htc->hash, .seed = htc->seed, .allocator = allocator};
+	atomic_init(&htc->epoch, 0);
+	pthread_mutex_init(&htc->epochLock, NULL);
+	for (int i = 0; i < HTC_SHARDS; ++i) {
+		struct HTC_shard *shard = &htc->shards[i];
+		struct HT *table = allocate(allocator, sizeof(*table));
+		*table = htNewWith(cap / HTC_SHARDS, eSize, &shardParams);
+		pthread_mutex_init(&shard->lock, NULL);
+		atomic_init(&shard->seq, 0);
+		atomic_init(&shard->table, table);
+	}
+	for (int i = 0; i < HTC_READER_SLOTS; ++i) {
+		atomic_init(&htc->readers[i].count[0], 0);
+		atomic_init(&htc->readers[i].count[1], 0);
+	}
+	return htc;
+}
+
+void htcFree(struct HTC *htc)
+{
+	for (int i = 0; i < HTC_SHARDS; ++i) {
+		struct HT *table = atomic_load(&htc->shards[i].table);
+		struct HT_allocator const *allocator = table->allocator;
+		htFree(table);
+		deallocate(allocator, table, sizeof(*table));
+		pthread_mutex_destroy(&htc->shards[i].lock);
+	}
+	pthread_mutex_destroy(&htc->epochLock);
+	free(htc);
+}
+
+void htcSet(struct HTC *htc, void const *name, HT_len length, void *value)
+{
+	HT_hash hash = htc->hash(name, length, htc->seed);
+	struct HTC_shard *shard = shard_of(htc, hash);
+	pthread_mutex_lock(&shard->lock);
+	struct HT *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	if ((double)(table->fill + 1) / (double)table->cap > load_factor)
+		table = htc_resize(htc, shard, table, table->cap * 2);
+	struct HT_key key = make_key(name, length, hash);
+	htc_write_begin(shard);
+	struct search_result search = locate(table, &key);
+	if (search.found) {
+		memcpy(value_at(table, search.slot), value, table->eSize);
+	} else {
+		++table->fill;
+		char buf[table->eSize];
+		memcpy(buf, value, table->eSize);
+		insert_at(table, key, buf, search.slot);
+	}
+	htc_write_end(shard);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void htcDel(struct HTC *htc, void const *name, HT_len length)
+{
+	HT_hash hash = htc->hash(name, length, htc->seed);
+	struct HTC_shard *shard = shard_of(htc, hash);
+	pthread_mutex_lock(&shard->lock);
+	struct HT *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+	struct search_result search = find(table, make_key(name, length, hash));
+	if (search.found) {
+		htc_write_begin(shard);
+		remove_at(table, search.slot);
+		htc_write_end(shard);
+		--table->fill;
+		if ((double)table->fill / (double)table->cap < shrink_factor)
+			htc_resize(htc, shard, table, table->cap / 2);
+		else if (arena_wasted(table))
+			htc_resize(htc, shard, table, table->cap);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+bool htcHas(struct HTC *htc, void const *name, HT_len length)
+{
+	return htcGet(htc, name, length, NULL);
+}
+
+bool htcGet(struct HTC *htc, void const *name, HT_len length, void *out)
+{
+	HT_hash hash = htc->hash(name, length, htc->seed);
+	struct HTC_shard *shard = shard_of(htc, hash);
+	struct HT_key key = make_key(name, length, hash);
+	atomic_uint *reader = htc_enter(htc);
+	bool found;
+	for (;;) {
+		unsigned seq = atomic_load_explicit(&shard->seq, memory_order_acquire);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		struct HT *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+		found = htc_find(table, shard, seq, key, out);
+		if (!htc_changed(shard, seq))
+			break;
+	}
+	htc_leave(reader);
+	return found;
+}
+
+#endif
+
 #endif
@@ -10,6 +10,10 @@ void dh_cuts_suite(void);
 int main()
 {
 	dh_init(stdout);
+#ifdef TEST_CALM_AVX2
+	/* The calm suite of this build needs AVX2 and FMA throughout. */
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+#endif
 	dh_branch (
 		calm_suite();
 	)
@@ -1,9 +1,14 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "dh_cuts.h"
 
 #define CM_IMPLEMENT_HERE
+/* Small enough that the bigger batches below take the streaming and threaded paths. */
+#define CM_STREAM_BYTES 4096
+#define CM_OPTION_PARALLEL 1
+#define CM_PARALLEL_MIN 64
 #include "calm.h"
 
 const double EPSILON = 0.0001;
@@ -87,6 +92,39 @@ void test_inverse_m16_failure(void)
 	dh_pop();
 }
 
+void test_inverse_m16_scaling(void)
+{
+	dh_push("matrix inverse judges singularity by relative size");
+	/* The third column is a combination of the first two, up to rounding. */
+	float c[16] = {
+		1, 2, 3, 4,
+		5, 6, 7, 8,
+		0, 0, 0, 0,
+		1, 0, 0, 1};
+	for (int i = 0; i < 4; i++)
+		c[8 + i] = 0.1f * c[i] + 0.3f * c[4 + i];
+	dh_assert(cmp_m16(cm_inverse_m16(cm_send_m16(c)), cm_identity_m16()));
+	/* Tiny, but perfectly well conditioned. */
+	const cm_m16 D = cm_send_m16((float[]){
+		1, 0,    0, 0,
+		0, 1e-8, 0, 0,
+		0, 0,    1, 0,
+		0, 0,    0, 1});
+	const cm_m16 Dinv = cm_inverse_m16(D);
+	float d[16];
+	cm_recv_m16(Dinv, d);
+	dh_assert(fabs(d[5] - 1e8) < 1e8 * EPSILON);
+	dh_assert(cmp_m16(cm_dot_m16(D, Dinv), cm_identity_m16()));
+	/* The same for a single column of an otherwise ordinary matrix. */
+	const cm_m16 m = cm_send_m16((float[]){
+		 1,    4,    2,    3,
+		 0, 1e-7, 4e-7, 4e-7,
+		-1,    0,    1,    0,
+		 2,    0,    4,    1});
+	dh_assert(cmp_m16(cm_dot_m16(m, cm_inverse_m16(m)), cm_identity_m16()));
+	dh_pop();
+}
+
 void test_calm_look_at(void)
 {
 	dh_push("build look at matrix");
@@ -141,15 +179,264 @@ void test_calm_qt_cumulate(void)
 	dh_pop();
 }
 
+/* The SIMD backends are checked against plain scalar arithmetic on random inputs.
+ * The Makefile also builds this suite with the fallback backend. */
+static float random_f1(void)
+{
+	return rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static cm_m16 random_m16(float m[16])
+{
+	for (int i = 0; i < 16; i++)
+		m[i] = random_f1();
+	return cm_send_m16(m);
+}
+
+void test_calm_against_scalar(void)
+{
+	dh_push("compare against scalar arithmetic");
+	srand(1234);
+	int wrong = 0;
+	for (int n = 0; n < 1000; n++) {
+		float l[16], r[16], e[16];
+		cm_m16 lm = random_m16(l), rm = random_m16(r);
+		cm_v4 lv = lm.c[0], rv = rm.c[0];
+		wrong += fabs(cm_hsum_v4(lv) - (l[0] + l[1] + l[2] + l[3])) > EPSILON;
+		wrong += fabs(cm_hsum_v3(lv) - (l[0] + l[1] + l[2])) > EPSILON;
+		wrong += fabs(cm_dot_v4(lv, rv) - (l[0]*r[0] + l[1]*r[1] + l[2]*r[2] + l[3]*r[3])) > EPSILON;
+		for (int i = 0; i < 4; i++)
+			wrong += !cmp_v4(cm_spread_v4(lv, i), cm_send1_v4(l[i]));
+
+		for (int i = 0; i < 4; i++)
+			e[i] = l[i]*r[0] + l[4+i]*r[1] + l[8+i]*r[2] + l[12+i]*r[3];
+		wrong += !cmp_v4(cm_apply_m16(lm, rv), cm_send_v4(e));
+		for (int c = 0; c < 4; c++) {
+			for (int i = 0; i < 4; i++)
+				e[4*c+i] = l[i]*r[4*c] + l[4+i]*r[4*c+1] + l[8+i]*r[4*c+2] + l[12+i]*r[4*c+3];
+		}
+		wrong += !cmp_m16(cm_dot_m16(lm, rm), cm_send_m16(e));
+
+		e[0] = r[3]*l[0] + r[0]*l[3] + r[1]*l[2] - r[2]*l[1];
+		e[1] = r[3]*l[1] + r[1]*l[3] + r[2]*l[0] - r[0]*l[2];
+		e[2] = r[3]*l[2] + r[2]*l[3] + r[0]*l[1] - r[1]*l[0];
+		e[3] = r[3]*l[3] - r[0]*l[0] - r[1]*l[1] - r[2]*l[2];
+		wrong += !cmp_v4(cm_cum_qt(lv, rv), cm_send_v4(e));
+
+		/* A strong diagonal keeps the matrix well away from singular. */
+		for (int i = 0; i < 4; i++)
+			l[5*i] += 4.0f;
+		lm = cm_send_m16(l);
+		wrong += !cmp_m16(cm_dot_m16(lm, cm_inverse_m16(lm)), cm_identity_m16());
+		wrong += !cmp_m16(cm_dot_m16(cm_inverse_m16(lm), lm), cm_identity_m16());
+	}
+	dh_assertiq(wrong, 0);
+	dh_pop();
+}
+
+void test_calm_batch_backend(void)
+{
+	dh_push("choose batch backend");
+	int best = cm_batch_backend();
+	dh_assert(best >= CM_BACKEND);
+#if CM_OPTION_DISPATCH
+	dh_assertiq(best == CM_BACKEND_AVX2, __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+#endif
+	cm_set_batch_backend(CM_BACKEND);
+	dh_assertiq(cm_batch_backend(), CM_BACKEND);
+	cm_set_batch_backend(CM_BACKEND_AVX2 + 1);
+	dh_assertiq(cm_batch_backend(), CM_BACKEND);
+	cm_set_batch_backend(best);
+	dh_assertiq(cm_batch_backend(), best);
+	dh_pop();
+}
+
+/* Checks either output against transforming the points of aos one by one. */
+static int check_batch(cm_m16 m, cm_v4 const *aos, cm_f1 *const soaOut[4], cm_v4 const *aosOut,
+	size_t n, int project)
+{
+	int wrong = 0;
+	for (size_t i = 0; i < n; i++) {
+		float e[4];
+		cm_recv_v4(cm_apply_m16(m, aos[i]), e);
+		if (project) {
+			e[0] /= e[3], e[1] /= e[3], e[2] /= e[3];
+			e[3] = 1.0f / e[3];
+		}
+		if (aosOut != NULL)
+			wrong += !cmp_v4(aosOut[i], cm_send_v4(e));
+		for (int r = 0; r < 4; r++) {
+			if (soaOut != NULL && soaOut[r] != NULL)
+				wrong += fabs(soaOut[r][i] - e[r]) > EPSILON;
+		}
+	}
+	return wrong;
+}
+
+void test_calm_batches(void)
+{
+	dh_push("batched transforms");
+	float mf[16];
+	cm_m16 m = random_m16(mf);
+	/* Keeps w well away from zero for the perspective divide. */
+	mf[3] = mf[7] = mf[11] = 0.1f, mf[15] = 2.0f;
+	m = cm_send_m16(mf);
+	int backends[] = {CM_BACKEND, cm_batch_backend()};
+	size_t sizes[] = {0, 1, 7, 37, 1001};
+	int wrong = 0;
+	for (int b = 0; b < 2; b++) {
+		cm_set_batch_backend(backends[b]);
+		for (int s = 0; s < 5; s++) {
+			/* The SoA arrays are padded to 32 bytes, so that they are aligned alike, first all
+			 * of them, then all off by one element. The last layout misaligns them against
+			 * each other, which rules out the aligned head and the streaming stores. */
+			for (int layout = 0; layout < 3; layout++) {
+				size_t n = sizes[s], off = layout > 0, stride = layout < 2 ? (n + 8) & ~(size_t)7 : n + 1;
+				cm_v4 *aos = malloc((n + 1) * sizeof(*aos)), *aosOut = malloc((n + 1) * sizeof(*aos));
+				float *buf = aligned_alloc(32, 8 * stride * sizeof(*buf));
+				cm_f1 *soa[4], *soaOut[4];
+				for (int r = 0; r < 4; r++) {
+					soa[r] = buf + r * stride + off;
+					soaOut[r] = buf + (4 + r) * stride + off;
+				}
+				aos += off, aosOut += off;
+				for (size_t i = 0; i < n; i++)
+					aos[i] = cm_new_v4(random_f1(), random_f1(), random_f1(), 1.0f);
+
+				cm_aos_to_soa(aos, soa, n);
+				cm_soa_to_aos((cm_f1 const *const *)soa, aosOut, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_v4(aos[i], aosOut[i]);
+
+				for (int project = 0; project < 2; project++) {
+					(project ? cm_project_m16_batch : cm_apply_m16_batch)(m, aos, aosOut, n);
+					wrong += check_batch(m, aos, NULL, aosOut, n, project);
+					(project ? cm_project_m16_soa : cm_apply_m16_soa)(m, (cm_f1 const *const *)soa, soaOut, n);
+					wrong += check_batch(m, aos, soaOut, NULL, n, project);
+					/* The same with w implied and not stored. */
+					cm_f1 const *xyz[4] = {soa[0], soa[1], soa[2], NULL};
+					cm_f1 *xyzOut[4] = {soaOut[0], soaOut[1], soaOut[2], NULL};
+					(project ? cm_project_m16_soa : cm_apply_m16_soa)(m, xyz, xyzOut, n);
+					wrong += check_batch(m, aos, xyzOut, NULL, n, project);
+				}
+				/* In place. */
+				memcpy(aosOut, aos, n * sizeof(*aos));
+				cm_apply_m16_batch(m, aosOut, aosOut, n);
+				wrong += check_batch(m, aos, NULL, aosOut, n, 0);
+
+				free(aos - off);
+				free(aosOut - off);
+				free(buf);
+			}
+		}
+	}
+	cm_set_batch_backend(backends[1]);
+	dh_assertiq(wrong, 0);
+	dh_pop();
+}
+
+/* Near the identity, so that long chains of products stay small. */
+static cm_m16 random_transform(void)
+{
+	float f[16];
+	for (int i = 0; i < 16; i++)
+		f[i] = random_f1() * 0.25f + (i % 5 == 0);
+	return cm_send_m16(f);
+}
+
+void test_calm_dot_batches(void)
+{
+	dh_push("batched matrix products");
+	int backends[] = {CM_BACKEND, cm_batch_backend()};
+	size_t sizes[] = {0, 1, 5, 1000};
+	int wrong = 0;
+	for (int b = 0; b < 2; b++) {
+		cm_set_batch_backend(backends[b]);
+		/* The last count is more than CM_MAX_THREADS, and gets clamped to it. */
+		int threadCounts[] = {1, 4, 1000};
+		for (int t = 0; t < 3; t++) {
+			cm_set_batch_threads(threadCounts[t]);
+			for (int s = 0; s < 4; s++) {
+				size_t n = sizes[s];
+				cm_m16 *l = malloc((n + 1) * sizeof(*l)), *r = malloc((n + 1) * sizeof(*r));
+				cm_m16 *out = malloc((n + 1) * sizeof(*out)), *e = malloc((n + 1) * sizeof(*e));
+				cm_m16 *e1 = malloc((n + 1) * sizeof(*e1));
+				size_t *parent = malloc((n + 1) * sizeof(*parent));
+				for (size_t i = 0; i < n; i++) {
+					l[i] = random_transform();
+					r[i] = random_transform();
+					e[i] = cm_dot_m16(l[i], r[i]);
+				}
+				cm_dot_m16_batch(l, r, out, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_m16(out[i], e[i]);
+				/* In place, on either side. */
+				memcpy(out, r, n * sizeof(*r));
+				cm_dot_m16_batch(l, out, out, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_m16(out[i], e[i]);
+				memcpy(out, l, n * sizeof(*l));
+				cm_dot_m16_batch(out, r, out, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_m16(out[i], e[i]);
+
+				/* A hierarchy with node 0 as the root, so that l[0] is its parent. */
+				if (n > 0)
+					l[0] = r[0] = cm_identity_m16();
+				for (size_t i = 0; i < n; i++) {
+					parent[i] = i > 0 ? (size_t)rand() % i : 0;
+					e[i] = cm_dot_m16(l[parent[i]], r[i]);
+				}
+				cm_dot_m16_indexed(l, parent, r, out, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_m16(out[i], e[i]);
+				/* Walking it with the results as parents. */
+				for (size_t i = 0; i < n; i++)
+					e[i] = cm_dot_m16(i > 0 ? e[parent[i]] : cm_identity_m16(), r[i]);
+				if (n > 0)
+					out[0] = cm_identity_m16();
+				cm_dot_m16_indexed(out, parent, r, out, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_m16(out[i], e[i]);
+				/* The same with the root kept just before the results, so that mats
+				 * only overlaps out: mats[j] is out[j - 1]. */
+				for (size_t i = 0; i < n; i++) {
+					parent[i] = (size_t)rand() % (i + 1);
+					e1[i] = cm_dot_m16(parent[i] > 0 ? e1[parent[i] - 1] : cm_identity_m16(), r[i]);
+				}
+				out[0] = cm_identity_m16();
+				cm_dot_m16_indexed(out, parent, r, out + 1, n);
+				for (size_t i = 0; i < n; i++)
+					wrong += !cmp_m16(out[i + 1], e1[i]);
+				free(e1);
+				free(l);
+				free(r);
+				free(out);
+				free(e);
+				free(parent);
+			}
+		}
+	}
+	cm_set_batch_backend(backends[1]);
+	cm_set_batch_threads(1);
+	dh_assertiq(wrong, 0);
+	dh_pop();
+}
+
 void calm_suite(void)
 {
 	dh_push("3D Math");
 	test_calm_mul_m16();
 	test_inverse_m16_success();
 	test_inverse_m16_failure();
+	test_inverse_m16_scaling();
 	test_calm_look_at();
 	test_calm_qt_from_axis();
 	test_calm_m16_from_qt();
 	test_calm_qt_cumulate();
+	test_calm_against_scalar();
+	test_calm_batch_backend();
+	test_calm_batches();
+	test_calm_dot_batches();
 	dh_pop();
 }
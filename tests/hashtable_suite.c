@@ -2,10 +2,14 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "dh_cuts.h"
 
 #define HT_IMPLEMENT_HERE
+#define HT_OPTION_CONCURRENT 1
+#define HT_OPTION_STATS 1
+#define HT_OPTION_PARALLEL 1
 #include "hashtable.h"
 
 char *my_strdup(char const *string)
@@ -21,6 +25,7 @@ void test_insertions(void)
 #define NUM_ITERATIONS 5000
 	dh_push("batch insertions and lookups");
 	struct HT ht = htNew(500, sizeof(int));
+	dh_assertiq(ht.cap, 512);
 	int values[NUM_ITERATIONS];
 	char const *keys[NUM_ITERATIONS];
 	for (int i = 0; i < NUM_ITERATIONS; ++i) {
@@ -44,6 +49,936 @@ void test_insertions(void)
 		dh_pop();
 	}
 	htFree(&ht);
+	for (int i = 0; i < NUM_ITERATIONS; ++i)
+		free((char *)keys[i]);
+	dh_pop();
+}
+
+void test_deletions(void)
+{
+	dh_push("interleaved insertions and deletions");
+	struct HT ht = htNew(16, sizeof(int));
+	char names[NUM_ITERATIONS][8];
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		sprintf(names[i], "%d", i);
+		htSet(&ht, names[i], strlen(names[i]), &i);
+		if (i % 3 == 0)
+			htDel(&ht, names[i / 2], strlen(names[i / 2]));
+	}
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		dh_push("lookup #%d", i);
+		/* Key #i is deleted right after insertion #2i or #2i+1, whichever is a multiple of 3. */
+		int j = 2 * i % 3 == 0 ? 2 * i : 2 * i + 1;
+		bool deleted = j % 3 == 0 && j < NUM_ITERATIONS;
+		dh_assertiq(htHas(&ht, names[i], strlen(names[i])), !deleted);
+		if (!deleted) {
+			dh_assertiq(*(int*)htGet(&ht, names[i], strlen(names[i])), i);
+		}
+		dh_pop();
+	}
+	htFree(&ht);
+	dh_pop();
+}
+
+void test_boundary_churn(void)
+{
+	dh_push("insertions and deletions near the shrink boundary");
+	struct HT ht = htNew(16, sizeof(int));
+	char names[410][8];
+	for (int i = 0; i < 410; ++i) {
+		sprintf(names[i], "%d", i);
+		htSet(&ht, names[i], strlen(names[i]), &i);
+	}
+	size_t cap = ht.cap;
+	for (int i = 0; i < 1000; ++i) {
+		htDel(&ht, names[0], strlen(names[0]));
+		dh_assertiq(ht.cap, cap);
+		htSet(&ht, names[0], strlen(names[0]), &i);
+		dh_assertiq(ht.cap, cap);
+	}
+	htFree(&ht);
+	dh_pop();
+}
+
+static size_t pending_migration(struct HT *ht)
+{
+	return ht->old != NULL ? ht->old->cap - ht->migrated : 0;
+}
+
+void test_incremental_resize(void)
+{
+	dh_push("incremental resizing");
+	struct HT ht = htNewWith(16, sizeof(int), &(struct HT_params){.flags = HT_INCREMENTAL});
+	char names[NUM_ITERATIONS][8];
+	for (int i = 0; i < 2 * NUM_ITERATIONS; ++i) {
+		int k = i < NUM_ITERATIONS ? i : 2 * NUM_ITERATIONS - 1 - i;
+		dh_push("operation #%d", i);
+		size_t before = pending_migration(&ht);
+		if (i < NUM_ITERATIONS) {
+			sprintf(names[k], "%d", k);
+			htSet(&ht, names[k], strlen(names[k]), &k);
+		} else {
+			htDel(&ht, names[k], strlen(names[k]));
+		}
+		size_t after = pending_migration(&ht);
+		/* No single operation may migrate more than a bounded number of slots,
+		 * and a new resize may only begin once the previous one is (nearly) done. */
+		if (after <= before) {
+			dh_assert(before - after <= HT_MIGRATE_STEP);
+		} else {
+			dh_assert(before <= HT_MIGRATE_STEP);
+		}
+		if (i < NUM_ITERATIONS || k > 0) {
+			int *value = htGet(&ht, names[k / 2], strlen(names[k / 2]));
+			dh_assert(value != NULL && *value == k / 2);
+		}
+		dh_pop();
+	}
+	dh_assertiq(ht.fill, 0);
+	htFree(&ht);
+	dh_pop();
+}
+
+static HT_hash constant_hash(void const *data, HT_len length, uint64_t seed)
+{
+	(void)data, (void)length, (void)seed;
+	return 7;
+}
+
+void test_hash_functions(void)
+{
+	dh_push("selectable hash functions");
+	struct HT_params params[] = {
+		{.hash = htHashOneAtATime},
+		{.flags = HT_RANDOM_SEED},
+		{.hash = constant_hash},
+	};
+	char names[500][80];
+	for (int p = 0; p < 3; ++p) {
+		dh_push("hash function #%d", p);
+		struct HT ht = htNewWith(16, sizeof(int), &params[p]);
+		for (int i = 0; i < 500; ++i) {
+			int length = sprintf(names[i], "%0*d", 1 + i % 79, i);
+			htSet(&ht, names[i], length, &i);
+		}
+		for (int i = 0; i < 500; ++i) {
+			int *value = htGet(&ht, names[i], strlen(names[i]));
+			dh_assert(value != NULL && *value == i);
+		}
+		htFree(&ht);
+		dh_pop();
+	}
+	struct HT a = htNewWith(16, sizeof(int), &params[1]);
+	struct HT b = htNewWith(16, sizeof(int), &params[1]);
+	dh_assert(a.seed != b.seed);
+	htFree(&a);
+	htFree(&b);
+	dh_pop();
+}
+
+void test_long_clusters(void)
+{
+	dh_push("clusters longer than the stored distances");
+	/* Every key shares the same home slot, so the last ones lie further than 65535 slots away.
+	 * Only the top bits that make up the control bytes differ, to keep key comparisons down. */
+	enum { COUNT = 66000, DELETED = 100 };
+	static int keys[COUNT];
+	static HT_hash hashes[COUNT];
+	struct HT ht = htNew(16, sizeof(int));
+	for (int i = 0; i < COUNT; ++i) {
+		keys[i] = i;
+		hashes[i] = (HT_hash)(i % 128) << (8 * sizeof(HT_hash) - 7) | 7;
+		htSetHashed(&ht, &keys[i], sizeof(keys[i]), hashes[i], &i);
+	}
+	for (int i = 0; i < DELETED; ++i)
+		htDelHashed(&ht, &keys[i], sizeof(keys[i]), hashes[i]);
+	for (int i = 0; i < COUNT; i += i < DELETED || i >= 65400 ? 1 : 97) {
+		dh_push("lookup #%d", i);
+		int *value = htGetHashed(&ht, &keys[i], sizeof(keys[i]), hashes[i]);
+		dh_assert(i < DELETED ? value == NULL : value != NULL && *value == i);
+		dh_pop();
+	}
+	htFree(&ht);
+	dh_pop();
+}
+
+void test_upserts(void)
+{
+	dh_push("single-probe upserts");
+	struct HT ht = htNew(16, sizeof(int));
+	char names[100][8];
+	for (int i = 0; i < 100; ++i)
+		sprintf(names[i], "%d", i);
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		int k = i * i % 100;
+		bool inserted;
+		int *count = htGetOrInsert(&ht, names[k], strlen(names[k]), &inserted);
+		dh_assertiq(inserted, *count == 0);
+		++*count;
+	}
+	int total = 0;
+	for (int i = 0; i < 100; ++i) {
+		int *count = htGet(&ht, names[i], strlen(names[i]));
+		total += count != NULL ? *count : 0;
+	}
+	dh_assertiq(total, NUM_ITERATIONS);
+	htFree(&ht);
+	dh_pop();
+}
+
+void test_prehashed(void)
+{
+	dh_push("caller-supplied hashes");
+	struct HT ht = htNew(16, sizeof(int));
+	char names[500][8];
+	for (int i = 0; i < 500; ++i) {
+		sprintf(names[i], "%d", i);
+		HT_hash hash = htHashWy(names[i], strlen(names[i]), 0);
+		htSetHashed(&ht, names[i], strlen(names[i]), hash, &i);
+	}
+	for (int i = 0; i < 500; i += 2) {
+		HT_hash hash = htHashWy(names[i], strlen(names[i]), 0);
+		htDelHashed(&ht, names[i], strlen(names[i]), hash);
+		dh_assert(!htHasHashed(&ht, names[i], strlen(names[i]), hash));
+	}
+	for (int i = 1; i < 500; i += 2) {
+		HT_hash hash = htHashWy(names[i], strlen(names[i]), 0);
+		int *value = htGetHashed(&ht, names[i], strlen(names[i]), hash);
+		dh_assert(value != NULL && *value == i);
+		dh_assert(htGet(&ht, names[i], strlen(names[i])) == value);
+	}
+	htFree(&ht);
+	dh_pop();
+}
+
+void test_batch_lookups(void)
+{
+	dh_push("batched lookups");
+	struct HT ht = htNew(16, sizeof(int));
+	char names[1000][8];
+	void const *batch[1000];
+	HT_len lengths[1000];
+	void *out[1000];
+	for (int i = 0; i < 1000; ++i) {
+		sprintf(names[i], "%d", i);
+		batch[i] = names[i];
+		lengths[i] = strlen(names[i]);
+		if (i % 3 != 0)
+			htSet(&ht, names[i], lengths[i], &i);
+	}
+	htGetBatch(&ht, batch, lengths, 1000, out);
+	for (int i = 0; i < 1000; ++i) {
+		dh_push("lookup #%d", i);
+		if (i % 3 != 0) {
+			dh_assert(out[i] != NULL && *(int*)out[i] == i);
+		} else {
+			dh_assert(out[i] == NULL);
+		}
+		dh_pop();
+	}
+	htFree(&ht);
+	dh_pop();
+}
+
+#define HTC_KEYS 2000
+#define HTC_WRITERS 4
+#define HTC_READERS 4
+#define HTC_ROUNDS 21
+
+struct htc_value { int v[16]; };
+
+static struct HTC *htc_table;
+static char htc_names[HTC_KEYS][8];
+static atomic_int htc_torn_reads;
+static atomic_int htc_writers_done;
+
+static void *htc_writer(void *arg)
+{
+	int first = (intptr_t)arg * (HTC_KEYS / HTC_WRITERS);
+	for (int r = 0; r < HTC_ROUNDS; ++r) {
+		for (int k = first; k < first + HTC_KEYS / HTC_WRITERS; ++k) {
+			struct htc_value value;
+			for (int i = 0; i < 16; ++i)
+				value.v[i] = k + r * HTC_KEYS;
+			if (r % 4 == 3 && k % 2 == 0)
+				htcDel(htc_table, htc_names[k], strlen(htc_names[k]));
+			else
+				htcSet(htc_table, htc_names[k], strlen(htc_names[k]), &value);
+		}
+	}
+	atomic_fetch_add(&htc_writers_done, 1);
+	return NULL;
+}
+
+static void *htc_reader(void *arg)
+{
+	(void)arg;
+	while (atomic_load(&htc_writers_done) < HTC_WRITERS) {
+		for (int k = 0; k < HTC_KEYS; ++k) {
+			struct htc_value value;
+			if (!htcGet(htc_table, htc_names[k], strlen(htc_names[k]), &value))
+				continue;
+			for (int i = 0; i < 16; ++i) {
+				if (value.v[i] != value.v[0] || value.v[i] % HTC_KEYS != k)
+					atomic_fetch_add(&htc_torn_reads, 1);
+			}
+		}
+	}
+	return NULL;
+}
+
+void test_concurrent(void)
+{
+	dh_push("concurrent readers and writers");
+	htc_table = htcNew(16, sizeof(struct htc_value), &(struct HT_params){0});
+	for (int k = 0; k < HTC_KEYS; ++k)
+		sprintf(htc_names[k], "%d", k);
+	pthread_t threads[HTC_WRITERS + HTC_READERS];
+	for (intptr_t t = 0; t < HTC_WRITERS + HTC_READERS; ++t)
+		pthread_create(&threads[t], NULL, t < HTC_WRITERS ? htc_writer : htc_reader, (void *)t);
+	for (int t = 0; t < HTC_WRITERS + HTC_READERS; ++t)
+		pthread_join(threads[t], NULL);
+	dh_assertiq(atomic_load(&htc_torn_reads), 0);
+	for (int k = 0; k < HTC_KEYS; ++k) {
+		struct htc_value value;
+		dh_assert(htcGet(htc_table, htc_names[k], strlen(htc_names[k]), &value));
+		dh_assertiq(value.v[15], k + (HTC_ROUNDS - 1) * HTC_KEYS);
+	}
+	for (int k = 0; k < HTC_KEYS; k += 2)
+		htcDel(htc_table, htc_names[k], strlen(htc_names[k]));
+	for (int k = 0; k < HTC_KEYS; ++k)
+		dh_assertiq(htcHas(htc_table, htc_names[k], strlen(htc_names[k])), k % 2);
+	htcFree(htc_table);
+	dh_pop();
+}
+
+struct point { float x, y, z; };
+
+HT_DECLARE(PointMap, uint64_t, struct point, htHashU64, htEqScalar)
+
+void test_typed_table(void)
+{
+	dh_push("typed table with integer keys");
+	struct PointMap map = PointMapNew(16);
+	for (uint64_t k = 0; k < NUM_ITERATIONS; ++k)
+		PointMapSet(&map, k * 7919, (struct point){k, 2 * k, 3 * k});
+	for (uint64_t k = 0; k < NUM_ITERATIONS; k += 2)
+		PointMapDel(&map, k * 7919);
+	dh_assertiq(map.fill, NUM_ITERATIONS / 2);
+	for (uint64_t k = 0; k < NUM_ITERATIONS; ++k) {
+		dh_push("lookup #%d", (int)k);
+		struct point *p = PointMapGet(&map, k * 7919);
+		dh_assertiq(PointMapHas(&map, k * 7919), k % 2);
+		if (k % 2) {
+			dh_assert(p != NULL && p->x == k && p->y == 2 * k && p->z == 3 * k);
+		}
+		dh_pop();
+	}
+	dh_assert(!PointMapHas(&map, 1));
+	PointMapFree(&map);
+	dh_pop();
+}
+
+static int owned_key(char *buf, int i)
+{
+	/* Mixes keys that fit into a slot with ones that have to go into the arena. */
+	return sprintf(buf, "%0*d", 1 + i % 40, i);
+}
+
+void test_owned_keys(void)
+{
+	dh_push("keys owned by the table");
+	struct HT_params params[] = {
+		{.flags = HT_OWN_KEYS},
+		{.flags = HT_OWN_KEYS | HT_INCREMENTAL},
+	};
+	for (int p = 0; p < 2; ++p) {
+		dh_push("variant #%d", p);
+		struct HT ht = htNewWith(16, sizeof(int), &params[p]);
+		char buf[64];
+		for (int i = 0; i < NUM_ITERATIONS; ++i) {
+			int length = owned_key(buf, i);
+			htSet(&ht, buf, length, &i);
+			memset(buf, 0, sizeof(buf));
+		}
+		for (int i = 0; i < NUM_ITERATIONS; i += 2) {
+			int length = owned_key(buf, i);
+			htDel(&ht, buf, length);
+		}
+		for (int i = 0; i < NUM_ITERATIONS; ++i) {
+			dh_push("lookup #%d", i);
+			int length = owned_key(buf, i);
+			int *value = htGet(&ht, buf, length);
+			if (i % 2) {
+				dh_assert(value != NULL && *value == i);
+			} else {
+				dh_assert(value == NULL);
+			}
+			dh_pop();
+		}
+		/* Deleting most keys shrinks the table, which compacts the arena. */
+		size_t arena = ht.arenaFill;
+		for (int i = 1; i < NUM_ITERATIONS - 100; i += 2) {
+			int length = owned_key(buf, i);
+			htDel(&ht, buf, length);
+		}
+		for (int i = 0; i < 100; ++i)
+			htHas(&ht, "", 0);
+		dh_assert(ht.old == NULL && ht.arenaFill < arena / 10);
+		/* So does replacing keys at a steady size, which never shrinks it. */
+		for (int i = 0; i < 20 * NUM_ITERATIONS; ++i) {
+			htSet(&ht, buf, sprintf(buf, "%040d", i), &i);
+			if (i >= 1000)
+				htDel(&ht, buf, sprintf(buf, "%040d", i - 1000));
+		}
+		dh_assertiq(htGet(&ht, buf, sprintf(buf, "%040d", 20 * NUM_ITERATIONS - 1000)) != NULL, 1);
+		dh_assertiq(htGet(&ht, buf, sprintf(buf, "%040d", 20 * NUM_ITERATIONS - 1001)) != NULL, 0);
+		dh_assert(ht.arenaFill - ht.arenaDead <= 1100 * 40);
+		dh_assert(ht.arenaFill <= 2 * 1100 * 40 + ht.cap);
+		htFree(&ht);
+		dh_pop();
+	}
+	dh_pop();
+}
+
+void test_wide_keys(void)
+{
+	dh_push("wide keys");
+#if !HT_OPTION_WIDE
+	/* Inline keys mustn't grow the slots of tables that don't even own theirs. */
+	dh_assertiq(sizeof(struct HT_key), sizeof(char const *) + 8);
+#else
+	dh_assertiq(sizeof(struct HT_key), 24);
+	/* Far longer than a short could describe, and differing only in the last byte. */
+	size_t length = 100000;
+	char *a = malloc(length), *b = malloc(length);
+	memset(a, 'x', length);
+	memcpy(b, a, length);
+	b[length - 1] = 'y';
+	struct HT ht = htNewWith(16, sizeof(int), &(struct HT_params){.flags = HT_OWN_KEYS});
+	int one = 1, two = 2;
+	htSet(&ht, a, length, &one);
+	htSet(&ht, b, length, &two);
+	memset(b, 0, length);
+	b[length - 1] = 'y';
+	dh_assert(*(int *)htGet(&ht, a, length) == 1);
+	dh_assert(htGet(&ht, b, length) == NULL);
+	memset(b, 'x', length - 1);
+	dh_assert(*(int *)htGet(&ht, b, length) == 2);
+	dh_assert(htGet(&ht, a, length - 1) == NULL);
+	dh_assertiq(ht.fill, 2);
+	htFree(&ht);
+	free(a);
+	free(b);
+#endif
+	dh_pop();
+}
+
+#if HT_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+
+void test_snapshots(void)
+{
+	/* Just past a resize, so that the incremental variant is saved mid-migration. */
+#define SNAPSHOT_KEYS 3290
+	dh_push("memory-mapped snapshots");
+	static char names[SNAPSHOT_KEYS + 1000][64];
+	struct HT_params params[] = {
+		{0},
+		{.flags = HT_OWN_KEYS},
+		{.flags = HT_INCREMENTAL, .seed = 42},
+	};
+	for (int p = 0; p < 3; ++p) {
+		dh_push("variant #%d", p);
+		struct HT ht = htNewWith(16, sizeof(int), &params[p]);
+		for (int i = 0; i < SNAPSHOT_KEYS + 1000; ++i)
+			owned_key(names[i], i);
+		for (int i = 0; i < SNAPSHOT_KEYS; ++i)
+			htSet(&ht, names[i], strlen(names[i]), &i);
+		for (int i = 0; i < SNAPSHOT_KEYS; i += 329)
+			htDel(&ht, names[i], strlen(names[i]));
+		dh_assert((ht.old != NULL) == (p == 2));
+		char path[] = "/tmp/ht_snapshot_XXXXXX";
+		close(mkstemp(path));
+		dh_assert(htSave(&ht, path));
+		htFree(&ht);
+
+		struct HT mapped;
+		dh_assert(htOpenMapped(&mapped, path, NULL));
+		dh_assertiq(mapped.fill, SNAPSHOT_KEYS - 10);
+		for (int i = 0; i < SNAPSHOT_KEYS + 1000; ++i) {
+			dh_push("lookup #%d", i);
+			int *value = htGet(&mapped, names[i], strlen(names[i]));
+			if (i < SNAPSHOT_KEYS && i % 329 != 0) {
+				dh_assert(value != NULL && *value == i);
+			} else {
+				dh_assert(value == NULL);
+			}
+			dh_pop();
+		}
+		htFree(&mapped);
+		unlink(path);
+		dh_pop();
+	}
+	dh_assert(!htOpenMapped(&(struct HT){0}, "/nonexistent/snapshot", NULL));
+
+	/* Headers that don't match the layout are rejected before anything is looked up. */
+	dh_push("corrupt headers");
+	struct HT ht = htNewWith(64, sizeof(int), &(struct HT_params){.flags = HT_OWN_KEYS});
+	for (int i = 0; i < 40; ++i)
+		htSet(&ht, names[i], strlen(names[i]), &i);
+	char path[] = "/tmp/ht_snapshot_XXXXXX";
+	close(mkstemp(path));
+	dh_assert(htSave(&ht, path));
+	uint64_t cap = ht.cap;
+	htFree(&ht);
+	struct { size_t offset; uint64_t value; } patches[] = {
+		{offsetof(struct HT_snapshot, cap), 0},
+		{offsetof(struct HT_snapshot, cap), cap + cap / 2},
+		{offsetof(struct HT_snapshot, cap), cap * 2},
+		{offsetof(struct HT_snapshot, fill), cap + 1},
+		{offsetof(struct HT_snapshot, eSize), 0},
+		{offsetof(struct HT_snapshot, eSize), 8},
+		{offsetof(struct HT_snapshot, values), 0},
+		{offsetof(struct HT_snapshot, ctrl), 1 << 20},
+	};
+	for (size_t p = 0; p < sizeof(patches) / sizeof(*patches); ++p) {
+		int fd = open(path, O_RDWR);
+		uint64_t saved;
+		pread(fd, &saved, sizeof(saved), patches[p].offset);
+		pwrite(fd, &patches[p].value, sizeof(saved), patches[p].offset);
+		struct HT mapped;
+		dh_push("patch #%d", (int)p);
+		dh_assert(!htOpenMapped(&mapped, path, NULL));
+		dh_pop();
+		pwrite(fd, &saved, sizeof(saved), patches[p].offset);
+		close(fd);
+	}
+	struct HT mapped;
+	dh_assert(htOpenMapped(&mapped, path, NULL));
+	htFree(&mapped);
+	truncate(path, snapshot_align(sizeof(struct HT_snapshot)) + 100);
+	dh_assert(!htOpenMapped(&mapped, path, NULL));
+	unlink(path);
+	dh_pop();
+	dh_pop();
+}
+#endif
+
+void test_frozen(void)
+{
+	dh_push("frozen tables");
+	static char names[NUM_ITERATIONS][64];
+	struct HT ht = htNewWith(16, sizeof(int), &(struct HT_params){.flags = HT_INCREMENTAL});
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		owned_key(names[i], i);
+		htSet(&ht, names[i], strlen(names[i]), &i);
+	}
+	for (int i = 0; i < NUM_ITERATIONS; i += 2)
+		htDel(&ht, names[i], strlen(names[i]));
+	struct HTF htf = htFreeze(&ht);
+	htFree(&ht);
+	dh_assertiq(htf.fill, NUM_ITERATIONS / 2);
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		dh_push("lookup #%d", i);
+		char copy[64];
+		strcpy(copy, names[i]);
+		int *value = htfGet(&htf, copy, strlen(copy));
+		if (i % 2) {
+			dh_assert(value != NULL && *value == i);
+		} else {
+			dh_assert(value == NULL);
+		}
+		dh_pop();
+	}
+	htfFree(&htf);
+
+	ht = htNew(16, sizeof(int));
+	htf = htFreeze(&ht);
+	dh_assert(!htfHas(&htf, "", 0));
+	htfFree(&htf);
+	htFree(&ht);
+	dh_pop();
+}
+
+struct counting_allocator
+{
+	size_t live;
+	size_t calls;
+};
+
+static void *counting_alloc(void *ctx, size_t size)
+{
+	struct counting_allocator *counter = ctx;
+	counter->live += size;
+	++counter->calls;
+	return calloc(1, size);
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t oldSize, size_t size)
+{
+	struct counting_allocator *counter = ctx;
+	counter->live += size - oldSize;
+	++counter->calls;
+	return realloc(ptr, size);
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size)
+{
+	struct counting_allocator *counter = ctx;
+	counter->live -= size;
+	free(ptr);
+}
+
+void test_allocators(void)
+{
+	dh_push("custom allocators");
+	struct counting_allocator counter = {0};
+	struct HT_allocator allocator = {counting_alloc, counting_realloc, counting_free, &counter};
+	struct HT_params params = {.flags = HT_OWN_KEYS | HT_INCREMENTAL, .allocator = &allocator};
+	struct HT ht = htNewWith(16, sizeof(int), &params);
+	char buf[64];
+	for (int i = 0; i < NUM_ITERATIONS; ++i)
+		htSet(&ht, buf, owned_key(buf, i), &i);
+	for (int i = 0; i < NUM_ITERATIONS; i += 2)
+		htDel(&ht, buf, owned_key(buf, i));
+	size_t calls = counter.calls;
+	struct HTF htf = htFreeze(&ht);
+	/* Besides its own five arrays, freezing needs some scratch space. */
+	dh_assert(counter.calls > calls + 5 && counter.live > 0);
+	htFree(&ht);
+	htfFree(&htf);
+	/* Every byte has to be given back, with the size it was allocated with. */
+	dh_assertiq(counter.live, 0);
+
+	/* Shards of concurrent tables, including the ones they get resized into. */
+	static int keys[NUM_ITERATIONS];
+	calls = counter.calls;
+	struct HTC *htc = htcNew(16, sizeof(int), &params);
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		keys[i] = i;
+		htcSet(htc, &keys[i], sizeof(int), &i);
+	}
+	dh_assert(counter.calls > calls + 2 * HTC_SHARDS);
+	htcFree(htc);
+	dh_assertiq(counter.live, 0);
+
+#if defined(__linux__)
+	/* Big enough that every array gets mapped separately. */
+	params = (struct HT_params){.flags = HT_OWN_KEYS, .allocator = &htHugePageAllocator};
+	ht = htNewWith(200000, sizeof(int), &params);
+	for (int i = 0; i < 200000; ++i)
+		htSet(&ht, &i, sizeof(i), &i);
+	int mismatches = 0;
+	for (int i = 0; i < 200000; ++i) {
+		int *value = htGet(&ht, &i, sizeof(i));
+		mismatches += value == NULL || *value != i;
+	}
+	dh_assertiq(mismatches, 0);
+	htFree(&ht);
+#endif
+	dh_pop();
+}
+
+void test_stats(void)
+{
+	dh_push("statistics");
+	struct HT_params params[] = {
+		{.flags = HT_INCREMENTAL},
+		{.hash = constant_hash},
+	};
+	static char names[NUM_ITERATIONS][64];
+	for (int p = 0; p < 2; ++p) {
+		dh_push("variant #%d", p);
+		int count = p == 0 ? NUM_ITERATIONS : 200;
+		struct HT ht = htNewWith(16, sizeof(int), &params[p]);
+		for (int i = 0; i < count; ++i) {
+			owned_key(names[i], i);
+			htSet(&ht, names[i], strlen(names[i]), &i);
+		}
+		struct HT_stats stats;
+		htStats(&ht, &stats);
+		size_t total = 0, probes = 0;
+		for (int b = 0; b < HT_STATS_BUCKETS; ++b) {
+			total += stats.displacement[b];
+			probes += stats.probeLength[b];
+		}
+		dh_assertiq(total, count);
+		/* Every insertion probes at least one group, and only the filter can turn lookups away. */
+		dh_assert(probes >= (size_t)count);
+		dh_assertiq(stats.probeLength[0], 0);
+		dh_assert(stats.rebuilds > 0 && stats.shrinks == 0);
+		dh_assert(stats.bytesAllocated > ht.cap * sizeof(struct HT_key));
+		if (p == 1) {
+			/* With every key in the same home slot, they simply queue up. */
+			dh_assertiq(stats.maxDisplacement, count - 1);
+			dh_assert(stats.comparesPerLookup > count / 4);
+			dh_assert(stats.probeLength[1] < probes / 4);
+			/* Key #i walks past the i keys before it, reading i + 1 control bytes. */
+			size_t expected[HT_STATS_BUCKETS] = {0};
+			for (int i = 0; i < count; ++i) {
+				int groups = (i + HT_GROUP) / HT_GROUP;
+				++expected[groups < HT_STATS_BUCKETS ? groups : HT_STATS_BUCKETS - 1];
+			}
+			for (int b = 0; b < HT_STATS_BUCKETS; ++b)
+				dh_assertiq(stats.probeLength[b], expected[b]);
+		} else {
+			dh_assert(stats.comparesPerLookup < 1.1);
+			dh_assert(stats.probeLength[1] > probes * 9 / 10);
+		}
+		for (int i = 0; i < count; ++i)
+			htDel(&ht, names[i], strlen(names[i]));
+		htStats(&ht, &stats);
+		dh_assert(stats.shrinks > 0 && stats.maxDisplacement == 0);
+		htFree(&ht);
+		dh_pop();
+	}
+	dh_pop();
+}
+
+void test_stable_values(void)
+{
+	dh_push("stable values");
+	unsigned flags[] = {HT_OWN_KEYS, HT_OWN_KEYS | HT_INCREMENTAL};
+	static int *pointers[NUM_ITERATIONS];
+	for (int f = 0; f < 2; ++f) {
+		dh_push("variant #%d", f);
+		/* Large enough that moving whole values around would be noticeable. */
+		struct HT ht = htNewWith(1, 256, &(struct HT_params){.flags = HT_STABLE_VALUES | flags[f]});
+		for (int i = 0; i < NUM_ITERATIONS; ++i) {
+			pointers[i] = htGetOrInsert(&ht, &i, sizeof(i), NULL);
+			pointers[i][0] = i;
+			pointers[i][63] = -i;
+		}
+		/* Growing the table many times over must not have moved any of them. */
+		int moved = 0;
+		for (int i = 0; i < NUM_ITERATIONS; ++i) {
+			int *value = htGet(&ht, &i, sizeof(i));
+			moved += value != pointers[i] || value[0] != i || value[63] != -i;
+		}
+		dh_assertiq(moved, 0);
+
+		for (int i = 0; i < NUM_ITERATIONS; i += 2)
+			htDel(&ht, &i, sizeof(i));
+		for (int i = 1; i < NUM_ITERATIONS; i += 2) {
+			int *value = htGet(&ht, &i, sizeof(i));
+			moved += value != pointers[i] || value[0] != i;
+		}
+		dh_assertiq(moved, 0);
+		/* The values of deleted keys are reused, and come back zeroed. */
+		int reused = 0, dirty = 0;
+		for (int i = 0; i < NUM_ITERATIONS; i += 2) {
+			int *value = htGetOrInsert(&ht, &i, sizeof(i), NULL);
+			dirty += value[0] != 0 || value[63] != 0;
+			for (int j = 0; j < NUM_ITERATIONS; j += 2)
+				reused += value == pointers[j];
+		}
+		dh_assertiq(reused, NUM_ITERATIONS / 2);
+		dh_assertiq(dirty, 0);
+		htFree(&ht);
+		dh_pop();
+	}
+	dh_pop();
+}
+
+void test_caches(void)
+{
+	dh_push("caches");
+	struct HT_cache cache = htCacheNew(100, 0, sizeof(int), &(struct HT_params){.flags = HT_OWN_KEYS});
+	size_t cap = cache.ht.cap;
+	/* Keys 0-9 are looked up all the time, the rest only once. */
+	int lost = 0;
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		for (int k = 0; k < 10 && i >= 10; ++k) {
+			int *value = htCacheGet(&cache, &k, sizeof(k));
+			lost += value == NULL || *value != k;
+		}
+		int *value = htCachePut(&cache, &i, sizeof(i), &i);
+		dh_assert(value != NULL && *value == i);
+		dh_assert(cache.ht.fill <= 100);
+	}
+	dh_assertiq(lost, 0);
+	dh_assertiq(cache.ht.cap, cap);
+	/* Both updates and insertions that evict probe the table just once. */
+	for (int i = NUM_ITERATIONS - 1; i <= NUM_ITERATIONS; ++i) {
+		size_t lookups = cache.ht.counters.lookups;
+		dh_assert(htCachePut(&cache, &i, sizeof(i), &i) != NULL);
+		dh_assertiq(cache.ht.counters.lookups, lookups + 1);
+	}
+	htCacheDel(&cache, &(int){5}, sizeof(int));
+	dh_assert(htCacheGet(&cache, &(int){5}, sizeof(int)) == NULL);
+	htCacheFree(&cache);
+
+	/* Long keys go into the arena, which must not grow with every eviction. */
+	cache = htCacheNew(0, 4000, sizeof(int), &(struct HT_params){.flags = HT_OWN_KEYS});
+	char buf[64];
+	for (int i = 0; i < NUM_ITERATIONS; ++i) {
+		int length = owned_key(buf, i);
+		int *value = htCachePut(&cache, buf, length, &i);
+		/* The new entry is still where it was put, whatever got evicted around it. */
+		dh_assert(value != NULL && value == htCacheGet(&cache, buf, length) && *value == i);
+		dh_assert(cache.bytes <= 4000);
+	}
+	dh_assert(cache.ht.arenaCap < 4 * 4000 + 4096);
+	int length = owned_key(buf, NUM_ITERATIONS - 1), *value = htCacheGet(&cache, buf, length);
+	dh_assert(value != NULL && *value == NUM_ITERATIONS - 1);
+	static char huge[4000];
+	dh_assert(htCachePut(&cache, huge, sizeof(huge), &length) == NULL);
+	htCacheFree(&cache);
+	dh_pop();
+}
+
+#define NUM_BULK 100000
+
+void test_bulk_build(void)
+{
+	dh_push("bulk building");
+	static char names[NUM_BULK + 100][48];
+	static char const *pointers[NUM_BULK + 100];
+	static HT_len lengths[NUM_BULK + 100];
+	static int values[NUM_BULK + 100];
+	/* The last few keys repeat the first ones. */
+	for (int i = 0; i < NUM_BULK + 100; ++i) {
+		values[i] = i % NUM_BULK;
+		lengths[i] = owned_key(names[i], values[i]);
+		pointers[i] = names[i];
+	}
+	struct HT_params params[] = {
+		{.threads = 1},
+		{.threads = 4},
+		{.threads = 3, .flags = HT_OWN_KEYS},
+		{.threads = 8, .flags = HT_OWN_KEYS | HT_STABLE_VALUES},
+	};
+	for (int p = 0; p < 4; ++p) {
+		dh_push("variant #%d", p);
+		struct HT ht = htBuildFrom((void const *const *)pointers, lengths, values,
+			NUM_BULK + 100, sizeof(int), &params[p]);
+		dh_assertiq(ht.fill, NUM_BULK);
+		int mismatches = 0;
+		for (int i = 0; i < NUM_BULK; ++i) {
+			int *value = htGet(&ht, names[i], lengths[i]);
+			mismatches += value == NULL || *value != i;
+		}
+		dh_assertiq(mismatches, 0);
+		/* Deletions rely on the entries being in proper Robin Hood order. */
+		for (int i = 0; i < NUM_BULK; i += 2)
+			htDel(&ht, names[i], lengths[i]);
+		for (int i = 0; i < NUM_BULK; ++i)
+			mismatches += htHas(&ht, names[i], lengths[i]) != (i % 2 == 1);
+		dh_assertiq(mismatches, 0);
+		htFree(&ht);
+		dh_pop();
+	}
+
+	/* Big enough for the last rebuild to be split over the threads. */
+	dh_push("parallel rebuilds");
+	struct HT ht = htNewWith(1, sizeof(int), &(struct HT_params){.threads = 4, .flags = HT_OWN_KEYS});
+	int count = 3 * HT_PARALLEL_MIN / 2 / load_factor;
+	for (int i = 0; i < count; ++i)
+		htSet(&ht, &i, sizeof(i), &i);
+	int mismatches = 0;
+	for (int i = 0; i < count; ++i) {
+		int *value = htGet(&ht, &i, sizeof(i));
+		mismatches += value == NULL || *value != i;
+	}
+	dh_assertiq(mismatches, 0);
+	htFree(&ht);
+	dh_pop();
+	dh_pop();
+}
+
+void test_filter(void)
+{
+	dh_push("negative lookup filter");
+	unsigned flags[] = {HT_FILTER, HT_FILTER | HT_INCREMENTAL | HT_OWN_KEYS};
+	for (int f = 0; f < 2; ++f) {
+		dh_push("variant #%d", f);
+		struct HT ht = htNewWith(1, sizeof(int), &(struct HT_params){.flags = flags[f]});
+		static int keys[2 * NUM_ITERATIONS];
+		for (int i = 0; i < 2 * NUM_ITERATIONS; ++i)
+			keys[i] = i;
+		for (int i = 0; i < NUM_ITERATIONS; ++i)
+			htSet(&ht, &keys[i], sizeof(int), &i);
+		int wrong = 0, passed = 0;
+		for (int i = 0; i < 2 * NUM_ITERATIONS; ++i) {
+			wrong += htHas(&ht, &keys[i], sizeof(int)) != (i < NUM_ITERATIONS);
+			passed += i >= NUM_ITERATIONS && filter_has(&ht, hash_of(&ht, (char *)&keys[i], sizeof(int)));
+		}
+		dh_assertiq(wrong, 0);
+		dh_assert(passed < NUM_ITERATIONS / 20);
+
+		/* Deleted keys stop passing once the filter has been rebuilt. */
+		for (int i = 0; i < NUM_ITERATIONS - 10; ++i)
+			htDel(&ht, &keys[i], sizeof(int));
+		passed = 0;
+		for (int i = 0; i < NUM_ITERATIONS; ++i) {
+			wrong += htHas(&ht, &keys[i], sizeof(int)) != (i >= NUM_ITERATIONS - 10);
+			passed += i < NUM_ITERATIONS - 10 && filter_has(&ht, hash_of(&ht, (char *)&keys[i], sizeof(int)));
+		}
+		dh_assertiq(wrong, 0);
+		dh_assert(passed < NUM_ITERATIONS / 20);
+		htFree(&ht);
+		dh_pop();
+	}
+	dh_pop();
+}
+
+void test_ordered(void)
+{
+	dh_push("ordered tables");
+	unsigned flags[] = {0, HT_OWN_KEYS};
+	static char names[NUM_ITERATIONS][48];
+	for (int f = 0; f < 2; ++f) {
+		dh_push("variant #%d", f);
+		struct HTO hto = htoNew(1, sizeof(int), &(struct HT_params){.flags = flags[f]});
+		dh_assertiq(hto.width, 1);
+		for (int i = 0; i < NUM_ITERATIONS; ++i) {
+			/* Long names end up in the arena of the owned variant. */
+			int length = sprintf(names[i], "%0*d", 1 + i % 40, i);
+			htoSet(&hto, names[i], length, &i);
+		}
+		dh_assertiq(hto.width, 2);
+		dh_assertiq(hto.live, NUM_ITERATIONS);
+		/* Deleting every other key, then putting a few back, puts those at the end. */
+		for (int i = 0; i < NUM_ITERATIONS; i += 2)
+			htoDel(&hto, names[i], strlen(names[i]));
+		for (int i = 0; i < 10; i += 2)
+			htoSet(&hto, names[i], strlen(names[i]), &i);
+		int wrong = 0;
+		for (int i = 0; i < NUM_ITERATIONS; ++i)
+			wrong += htoHas(&hto, names[i], strlen(names[i])) != (i % 2 == 1 || i < 10);
+		dh_assertiq(wrong, 0);
+		size_t cursor = 0;
+		void const *name;
+		HT_len length;
+		void *value;
+		int expected = 1;
+		while (htoNext(&hto, &cursor, &name, &length, &value)) {
+			int i = *(int *)value;
+			wrong += i != expected || length != (HT_len)strlen(names[i]) || memcmp(name, names[i], length) != 0;
+			expected = expected == NUM_ITERATIONS - 1 ? 0 : expected + 2;
+		}
+		dh_assertiq(wrong, 0);
+		dh_assertiq(expected, 10);
+
+		/* Churn squeezes out the holes without growing the table. */
+		size_t cap = hto.cap;
+		for (int r = 0; r < 20; ++r) {
+			for (int i = 1; i < NUM_ITERATIONS; i += 2)
+				htoDel(&hto, names[i], strlen(names[i]));
+			for (int i = 1; i < NUM_ITERATIONS; i += 2)
+				htoSet(&hto, names[i], strlen(names[i]), &i);
+		}
+		dh_assertiq(hto.cap, cap);
+		for (int i = 1; i < NUM_ITERATIONS; i += 2) {
+			int *value = htoGet(&hto, names[i], strlen(names[i]));
+			wrong += value == NULL || *value != i;
+		}
+		dh_assertiq(wrong, 0);
+		htoFree(&hto);
+		dh_pop();
+	}
 	dh_pop();
 }
 
@@ -51,5 +986,28 @@ void hashtable_suite(void)
 {
 	dh_push("hashtable");
 	test_insertions();
+	test_deletions();
+	test_boundary_churn();
+	test_incremental_resize();
+	test_hash_functions();
+	test_long_clusters();
+	test_upserts();
+	test_prehashed();
+	test_batch_lookups();
+	test_concurrent();
+	test_typed_table();
+	test_owned_keys();
+	test_wide_keys();
+#if HT_HAVE_MMAP
+	test_snapshots();
+#endif
+	test_frozen();
+	test_allocators();
+	test_stats();
+	test_stable_values();
+	test_caches();
+	test_bulk_build();
+	test_filter();
+	test_ordered();
 	dh_pop();
 }